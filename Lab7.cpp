@@ -1,17 +1,49 @@
 // polygon_fill.cpp
-// Compile: g++ polygon_fill.cpp -o polygon_fill -lGL -lGLU -lglut
+// Compile: g++ -O2 -pthread polygon_fill.cpp -o polygon_fill -lGL -lGLU -lglut
+// Headless (benchmarks only, no GL needed): g++ -O2 -pthread -DLAB7_HEADLESS polygon_fill.cpp -o polygon_fill
+// Usage:   ./polygon_fill [--threads N]            interactive GLUT window (N scanline fill threads, 0 = all cores)
+//          ./polygon_fill --bench-fill [W H]       time every fill on a WxH region (default 800x600)
+//          ./polygon_fill --bench-scanline [N]     banded scanline fill on 1..N threads
+//          ./polygon_fill --bench-polygons [--vertices N] [--size W H] [--count K] [--seed S]
+//                         every fill on K random convex, concave and star polygons, CSV
+//          ./polygon_fill --bench-aa [--size W H]  anti-aliased coverage fill vs aliased and 16x16 reference
+//          ./polygon_fill --bench-batch [N] [--size W H]  batch fill of many small / large polygons on 1..N threads
+//          ./polygon_fill --bench-tiled [W H] [--tile S] [--cache N] [--file F] [--vertices N]
+//                         flood/boundary fill of a file-backed tiled WxH image (default 16384x16384)
 
+#ifndef LAB7_HEADLESS
 #include <GL/glut.h>
+#endif
 #include <vector>
 #include <algorithm>
 #include <stack>
 #include <iostream>
 #include <cmath>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cctype>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <deque>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 struct Point { int x, y; };
 struct Color { unsigned char r, g, b; bool operator==(const Color &o) const { return r==o.r && g==o.g && b==o.b; } };
+static_assert(sizeof(Color) == 3, "Color must be tightly packed RGB for glDrawPixels");
 
 int winWidth = 800, winHeight = 600;
 
@@ -20,6 +52,8 @@ bool polygonFinished = false;
 
 enum Mode { IDLE, WAIT_SEED_FLOOD4, WAIT_SEED_FLOOD8, WAIT_SEED_BOUNDARY };
 Mode currentMode = IDLE;
+bool spanFills = true;   // flood/boundary: span (run-at-a-time) or classic per-pixel stack
+int fillThreads = 1;     // scanline fill bands are spread over this many threads
 
 // Colors
 Color backgroundColor = {255,255,255};
@@ -29,123 +63,608 @@ Color fillColor = {255,0,0};       // red fill
 // Utility: convert GLUT mouse y to our coordinate system (origin bottom-left)
 inline int convY(int y) { return winHeight - 1 - y; }
 
-// Set a pixel (draw point)
-void setPixel(int x, int y, const Color &c) {
-    if(x<0 || x>=winWidth || y<0 || y>=winHeight) return;
-    glBegin(GL_POINTS);
-      glColor3ub(c.r, c.g, c.b);
-      glVertex2i(x, y);
-    glEnd();
+// ---------- Software framebuffer ----------
+// The fills never talk to OpenGL per pixel: they read and write this RGB
+// buffer (row 0 at the bottom, like the GL window) and display() copies it
+// to the window with a single glDrawPixels. It works without a window too.
+struct Canvas {
+    int w = 0, h = 0;
+    vector<Color> px;
+
+    void resize(int W, int H, const Color &bg) { w = W; h = H; px.assign((size_t)W*H, bg); }
+    void clear(const Color &c) { std::fill(px.begin(), px.end(), c); }
+    Color* row(int y) { return px.data() + (size_t)y*w; }
+    const Color* row(int y) const { return px.data() + (size_t)y*w; }
+};
+Canvas canvas;
+
+// Set a pixel in the canvas
+inline void setPixel(int x, int y, const Color &c) {
+    if(x<0 || x>=canvas.w || y<0 || y>=canvas.h) return;
+    canvas.px[(size_t)y*canvas.w + x] = c;
 }
 
-// Get pixel color from framebuffer
-Color getPixel(int x, int y) {
-    Color c;
-    if(x<0 || x>=winWidth || y<0 || y>=winHeight) return c;
-    unsigned char pixel[3];
-    glReadPixels(x, y, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, pixel);
-    c.r = pixel[0]; c.g = pixel[1]; c.b = pixel[2];
-    return c;
+// Get pixel color from the canvas
+inline Color getPixel(int x, int y) {
+    Color c{};
+    if(x<0 || x>=canvas.w || y<0 || y>=canvas.h) return c;
+    return canvas.px[(size_t)y*canvas.w + x];
 }
 
-// Draw current polygon (outline and points)
-void drawPolygonOutline() {
-    // draw vertices as small points
-    glPointSize(5.0f);
-    glBegin(GL_POINTS);
-      glColor3ub(0,0,255); // blue vertices
-      for(auto &p: polygonPts) glVertex2i(p.x, p.y);
-    glEnd();
-    glPointSize(1.0f);
+// Bresenham line (both endpoints included), plot(x, y) per pixel
+template<class Plot>
+void plotLine(int x0, int y0, int x1, int y1, Plot plot) {
+    int dx = abs(x1-x0), sx = x0<x1 ? 1 : -1;
+    int dy = -abs(y1-y0), sy = y0<y1 ? 1 : -1;
+    int err = dx + dy;
+    for(;;) {
+        plot(x0, y0);
+        if(x0 == x1 && y0 == y1) break;
+        int e2 = 2*err;
+        if(e2 >= dy) { err += dy; x0 += sx; }
+        if(e2 <= dx) { err += dx; y0 += sy; }
+    }
+}
 
-    if(polygonPts.size() >= 2) {
-        glColor3ub(polygonColor.r, polygonColor.g, polygonColor.b);
-        glBegin(GL_LINE_LOOP);
-        for(auto &p: polygonPts) glVertex2i(p.x, p.y);
-        if(!polygonFinished) glutSwapBuffers(); // no loop if not finished (helps see preview)
-        glEnd();
+// Bresenham line into the canvas
+void drawLine(int x0, int y0, int x1, int y1, const Color &c) {
+    plotLine(x0, y0, x1, y1, [&](int x, int y){ setPixel(x, y, c); });
+}
+
+// Rasterize the closed polygon outline into the canvas; boundary fill and
+// flood fill stop at these pixels.
+void drawOutlineToCanvas() {
+    int n = polygonPts.size();
+    if(n < 2) return;
+    for(int i=0;i<n;i++) {
+        const Point &a = polygonPts[i], &b = polygonPts[(i+1)%n];
+        drawLine(a.x, a.y, b.x, b.y, polygonColor);
     }
 }
 
-// Clear window to backgroundColor
+// Clear the canvas to backgroundColor
 void clearWindow() {
-    glClearColor(backgroundColor.r/255.0f, backgroundColor.g/255.0f, backgroundColor.b/255.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glFlush();
+    canvas.clear(backgroundColor);
 }
 
+// Work counters for the fills: stack pushes, the deepest the stack got and
+// how many pixels were read (reads / filled pixels = revisit factor) for the
+// seed fills, and the peak bytes of stacks or edge tables for every fill.
+struct FillStats { size_t pushes = 0, maxStack = 0, reads = 0, auxBytes = 0; };
+FillStats fillStats;
+
 // ---------- Scanline Fill Implementation ----------
+// Edge x positions are exact fixed point: an integer part plus a fraction
+// num/dy with 0 <= num < dy, stepped by q + rem/dy per scanline with integer
+// adds and one carry (an integer DDA). x after k steps is therefore exact
+// and bit-identical to jumping k rows at once, however the walk was split,
+// and pixel centres that lie exactly on an edge are classified consistently.
 struct EdgeEntry {
+    int ymin;       // lower endpoint: first scanline the edge is active on
     int ymax;       // y coordinate where edge is no longer active
-    float x;        // x at current scanline (float)
-    float invSlope; // dx/dy
+    int x, num;     // x = x + num/dy at ymin in the edge table, at the current scanline in the AET
+    int dy;         // ymax - ymin
+    int q, rem;     // x step per scanline = q + rem/dy
+
+    void step() {   // branch-free carry: the carry pattern is unpredictable
+        num += rem;
+        int carry = num >= dy;
+        num -= carry ? dy : 0;
+        x += q + carry;
+    }
+    void advance(int k) {
+        int64_t t = (int64_t)rem * k + num;
+        x += (int)((int64_t)q * k + t / dy);
+        num = (int)(t % dy);
+    }
+    int ceilX() const  { return x + (num > 0); }
+    int floorX() const { return x; }
 };
 
-void scanlineFillPolygon() {
+inline bool edgeLess(const EdgeEntry &a, const EdgeEntry &b) {
+    return a.x != b.x ? a.x < b.x : (int64_t)a.num * b.dy < (int64_t)b.num * a.dy;
+}
+
+// Build the edge table entry for p1-p2 if the edge crosses rows minY..maxY
+// (horizontal edges never do).
+static bool makeEdge(Point p1, Point p2, int minY, int maxY, EdgeEntry &e) {
+    // skip horizontal edges
+    if(p1.y == p2.y) return false;
+    // ensure p1.y < p2.y
+    if(p1.y > p2.y) swap(p1, p2);
+    // skip edges entirely outside the filled rows
+    if(p2.y <= minY || p1.y > maxY) return false;
+
+    e.ymin = p1.y;
+    e.ymax = p2.y;
+    e.x = p1.x;
+    e.num = 0;
+    e.dy = p2.y - p1.y;
+    int dx = p2.x - p1.x;
+    e.q = dx >= 0 ? dx / e.dy : -((-dx + e.dy - 1) / e.dy);   // floor(dx/dy)
+    e.rem = dx - e.q * e.dy;
+    return true;
+}
+
+// Fill scanlines y0..y1, columns x0..x1, of a polygon with col. ET[0..nET)
+// holds its non-horizontal edges sorted by ymin, so the edges starting on one
+// scanline form a contiguous bucket and nothing is allocated per canvas row.
+// The active edges at y0 are picked straight out of it (started at or below
+// y0, end above it), so bands and tiles are independent of each other. The
+// AET stays sorted by x: edges move past each other rarely, so an insertion
+// sort per scanline is close to linear.
+static void scanlineFillBand(const EdgeEntry *ET, size_t nET, int y0, int y1, vector<EdgeEntry> &AET,
+                             int x0, int x1, const Color &col) {
+    AET.clear();
+    size_t next = upper_bound(ET, ET + nET, y0,
+                    [](int y, const EdgeEntry &e){ return y < e.ymin; }) - ET;
+    for(size_t i = 0; i < next; ++i) {
+        if(ET[i].ymax <= y0) continue;
+        EdgeEntry e = ET[i];
+        e.advance(y0 - e.ymin);
+        AET.push_back(e);
+    }
+    sort(AET.begin(), AET.end(), edgeLess);
+
+    for(int y = y0; y <= y1; ++y) {
+        if(y > y0) {
+            // 1) Step edges to this scanline, dropping those where ymax == y
+            bool expired = false;
+            for(auto &e : AET) { e.step(); expired |= e.ymax <= y; }
+            if(expired)
+                AET.erase(remove_if(AET.begin(), AET.end(),
+                            [y](const EdgeEntry &e){ return e.ymax <= y; }), AET.end());
+
+            // 2) Add edges starting at this scanline
+            for(; next < nET && ET[next].ymin == y; ++next) AET.push_back(ET[next]);
+        }
+
+        // 3) Restore x order by insertion
+        for(size_t i = 1; i < AET.size(); ++i) {
+            if(!edgeLess(AET[i], AET[i-1])) continue;
+            EdgeEntry e = AET[i];
+            size_t j = i;
+            for(; j > 0 && edgeLess(e, AET[j-1]); --j) AET[j] = AET[j-1];
+            AET[j] = e;
+        }
+
+        // 4) Fill pixels between pairs: ceil of the left edge to floor of the right
+        Color *row = canvas.row(y);
+        for(size_t i=0; i+1 < AET.size(); i += 2) {
+            int xStart = max(AET[i].ceilX(), x0);
+            int xEnd   = min(AET[i+1].floorX(), x1);
+            if(xStart <= xEnd) std::fill(row + xStart, row + xEnd + 1, col);
+        }
+    }
+}
+
+// threads > 1 splits minY..maxY into bands (a few per thread, so uneven
+// bands balance out) that workers claim from a shared counter. Every band
+// writes its own rows, so the result is identical to the serial fill.
+void scanlineFillPolygon(int threads = 1) {
     if(polygonPts.size() < 3) return;
 
     // Find ymin and ymax
     int minY = polygonPts[0].y, maxY = polygonPts[0].y;
     for(auto &p: polygonPts) { minY = min(minY, p.y); maxY = max(maxY, p.y); }
-    minY = max(minY, 0); maxY = min(maxY, winHeight-1);
-
-    int height = winHeight;
-    vector<vector<EdgeEntry>> ET(height); // Edge Table indexed by y
+    minY = max(minY, 0); maxY = min(maxY, canvas.h-1);
+    if(minY > maxY) return;
 
+    vector<EdgeEntry> ET; // Edge Table, sorted by ymin
     int n = polygonPts.size();
+    ET.reserve(n);
     for(int i=0;i<n;i++) {
-        Point p1 = polygonPts[i];
-        Point p2 = polygonPts[(i+1)%n];
-        // skip horizontal edges
-        if(p1.y == p2.y) continue;
-        // ensure p1.y < p2.y
-        if(p1.y > p2.y) swap(p1, p2);
-
         EdgeEntry e;
-        e.ymax = p2.y;
-        e.x = p1.x;
-        e.invSlope = (float)(p2.x - p1.x) / (float)(p2.y - p1.y);
-        int yIndex = p1.y;
-        if(yIndex < 0) yIndex = 0;
-        if(yIndex >= height) continue;
-        ET[yIndex].push_back(e);
+        if(makeEdge(polygonPts[i], polygonPts[(i+1)%n], minY, maxY, e)) ET.push_back(e);
+    }
+    sort(ET.begin(), ET.end(), [](const EdgeEntry &a, const EdgeEntry &b){ return a.ymin < b.ymin; });
+
+    if(threads <= 0) threads = max(1u, thread::hardware_concurrency());
+    int rows = maxY - minY + 1;
+    int nBands = min(rows, threads == 1 ? 1 : threads * 4);
+    atomic<size_t> aetBytes{0};
+    if(nBands <= 1) {
+        vector<EdgeEntry> AET;
+        scanlineFillBand(ET.data(), ET.size(), minY, maxY, AET, 0, canvas.w-1, fillColor);
+        aetBytes = AET.capacity() * sizeof(EdgeEntry);
+    } else {
+        atomic<int> next{0};
+        auto worker = [&]() {
+            vector<EdgeEntry> AET; // reused across this worker's bands
+            for(int b; (b = next++) < nBands; ) {
+                int y0 = minY + (int)((long long)rows * b / nBands);
+                int y1 = minY + (int)((long long)rows * (b+1) / nBands) - 1;
+                scanlineFillBand(ET.data(), ET.size(), y0, y1, AET, 0, canvas.w-1, fillColor);
+            }
+            aetBytes += AET.capacity() * sizeof(EdgeEntry);
+        };
+        vector<thread> pool;
+        for(int t = 1; t < threads; ++t) pool.emplace_back(worker);
+        worker();
+        for(auto &t : pool) t.join();
     }
+    fillStats.auxBytes = max(fillStats.auxBytes, ET.capacity() * sizeof(EdgeEntry) + aetBytes);
+}
 
-    vector<EdgeEntry> AET; // Active Edge Table
+// ---------- Batch polygon fill ----------
+// Fills many polygons, each with its own colour, in one pass over the canvas.
+// The canvas is cut into tiles of bandH full-width rows and polygons are
+// binned to the tiles they touch in submission order; a tile fills its
+// polygons clipped to its rows, so later polygons still paint over earlier
+// ones and the result equals filling them one by one with
+// scanlineFillPolygon. Tiles span the whole width because narrower ones made
+// every tile column step the same edges again, and on this machine the canvas
+// stays in cache anyway. Tiles go to a persistent worker pool. Edge tables,
+// tile bins and AETs live in vectors that are cleared but never shrunk, so
+// once they have grown to the workload a fill() does no heap allocation.
+struct PolygonRef { const Point *pts; int n; Color color; };
 
-    // For each scanline from minY to maxY-1
-    for(int y = minY; y <= maxY; ++y) {
-        // 1) Add edges starting at this scanline
-        if(y < height) {
-            for(auto &e : ET[y]) AET.push_back(e);
+struct BatchFiller {
+    explicit BatchFiller(int threads = 1, int bandH = 64) : bandH(max(1, bandH)) {
+        if(threads <= 0) threads = max(1u, thread::hardware_concurrency());
+        aets.resize(threads);
+        for(int t = 1; t < threads; ++t) pool.emplace_back(&BatchFiller::workerLoop, this, t);
+    }
+    ~BatchFiller() {
+        { lock_guard<mutex> lk(m); quit = true; }
+        wake.notify_all();
+        for(auto &t : pool) t.join();
+    }
+    BatchFiller(const BatchFiller &) = delete;
+    BatchFiller &operator=(const BatchFiller &) = delete;
+
+    void fill(const PolygonRef *polys, int count) {
+        edges.clear();
+        items.clear();
+        size_t maxEdges = 0;
+        int W = canvas.w, H = canvas.h;
+        for(int p = 0; p < count; ++p) {
+            const PolygonRef &pr = polys[p];
+            if(pr.n < 3) continue;
+            Item it;
+            it.x0 = it.x1 = pr.pts[0].x; it.y0 = it.y1 = pr.pts[0].y;
+            for(int i = 1; i < pr.n; ++i) {
+                it.x0 = min(it.x0, pr.pts[i].x); it.x1 = max(it.x1, pr.pts[i].x);
+                it.y0 = min(it.y0, pr.pts[i].y); it.y1 = max(it.y1, pr.pts[i].y);
+            }
+            it.x0 = max(it.x0, 0); it.x1 = min(it.x1, W-1);
+            it.y0 = max(it.y0, 0); it.y1 = min(it.y1, H-1);
+            if(it.x0 > it.x1 || it.y0 > it.y1) continue;
+            it.first = edges.size();
+            for(int i = 0; i < pr.n; ++i) {
+                EdgeEntry e;
+                if(makeEdge(pr.pts[i], pr.pts[(i+1)%pr.n], it.y0, it.y1, e)) edges.push_back(e);
+            }
+            it.count = edges.size() - it.first;
+            if(!it.count) continue;
+            maxEdges = max(maxEdges, it.count);
+            sort(edges.begin() + it.first, edges.end(), [](const EdgeEntry &a, const EdgeEntry &b){ return a.ymin < b.ymin; });
+            it.color = pr.color;
+            items.push_back(it);
         }
 
-        // 2) Remove edges where ymax == y
-        AET.erase(remove_if(AET.begin(), AET.end(),
-                    [y](const EdgeEntry &e){ return e.ymax <= y; }), AET.end());
+        // Bin items to tiles (counting sort, so each bin keeps submission order)
+        nTiles = (H + bandH - 1) / bandH;
+        binStart.assign(nTiles + 1, 0);
+        for(auto &it : items)
+            for(int t = it.y0 / bandH; t <= it.y1 / bandH; ++t) ++binStart[t + 1];
+        for(int t = 0; t < nTiles; ++t) binStart[t+1] += binStart[t];
+        binFill.assign(binStart.begin(), binStart.end() - 1);
+        binEntries.resize(binStart[nTiles]);
+        for(int i = 0; i < (int)items.size(); ++i)
+            for(int t = items[i].y0 / bandH; t <= items[i].y1 / bandH; ++t) binEntries[binFill[t]++] = i;
+
+        // Size every AET up front: which thread gets which polygon varies
+        for(auto &a : aets) a.reserve(maxEdges);
+        nextTile = 0;
+        {
+            lock_guard<mutex> lk(m);
+            busy = pool.size();
+            ++generation;
+        }
+        wake.notify_all();
+        fillTiles(0);
+        unique_lock<mutex> lk(m);
+        done.wait(lk, [&]{ return busy == 0; });
+    }
 
-        // 3) Sort AET by x
-        sort(AET.begin(), AET.end(), [](const EdgeEntry &a, const EdgeEntry &b){ return a.x < b.x; });
+    // Bytes held by the reusable arena (edge tables, bins, AETs)
+    size_t arenaBytes() const {
+        size_t b = edges.capacity() * sizeof(EdgeEntry) + items.capacity() * sizeof(Item)
+                 + (binStart.capacity() + binFill.capacity() + binEntries.capacity()) * sizeof(int);
+        for(auto &a : aets) b += a.capacity() * sizeof(EdgeEntry);
+        return b;
+    }
 
-        // 4) Fill pixels between pairs
-        for(size_t i=0; i+1 < AET.size(); i += 2) {
-            int xStart = (int)ceil(AET[i].x);
-            int xEnd   = (int)floor(AET[i+1].x);
-            for(int x = xStart; x <= xEnd; ++x) {
-                setPixel(x, y, fillColor);
+private:
+    struct Item { int x0, y0, x1, y1; size_t first, count; Color color; };
+
+    void fillTiles(int t) {
+        vector<EdgeEntry> &AET = aets[t];
+        for(int tile; (tile = nextTile++) < nTiles; ) {
+            int ty0 = tile * bandH, ty1 = min(ty0 + bandH, canvas.h) - 1;
+            for(int k = binStart[tile]; k < binStart[tile+1]; ++k) {
+                const Item &it = items[binEntries[k]];
+                scanlineFillBand(edges.data() + it.first, it.count, max(it.y0, ty0), min(it.y1, ty1), AET,
+                                 it.x0, it.x1, it.color);
             }
         }
+    }
 
-        // 5) For each edge in AET, update x += invSlope
-        for(auto &e : AET) e.x += e.invSlope;
+    void workerLoop(int t) {
+        unsigned seen = 0;
+        for(;;) {
+            {
+                unique_lock<mutex> lk(m);
+                wake.wait(lk, [&]{ return quit || generation != seen; });
+                if(quit) return;
+                seen = generation;
+            }
+            fillTiles(t);
+            lock_guard<mutex> lk(m);
+            if(--busy == 0) done.notify_one();
+        }
     }
 
-    glFlush();
+    int bandH, nTiles = 0;
+    vector<EdgeEntry> edges;          // every polygon's edge table, back to back
+    vector<Item> items;               // polygons that touch the canvas
+    vector<int> binStart, binFill, binEntries;
+    vector<vector<EdgeEntry>> aets;   // one AET per thread
+    vector<thread> pool;
+    mutex m;
+    condition_variable wake, done;
+    unsigned generation = 0;
+    int busy = 0;
+    bool quit = false;
+    atomic<int> nextTile{0};
+};
+
+// ---------- Anti-aliased coverage fill ----------
+// Pixel (x,y) is the unit square around its centre, the point the scanline
+// fill tests. Every edge adds its signed area to the cells of each row it
+// crosses; a running sum along the row then gives each pixel's winding
+// number, fractional where an edge passes through it, and the fill rule
+// turns that into coverage. Rows are processed in strips of AA_STRIP rows so
+// the accumulation buffer stays in cache, and strips can run in parallel.
+enum FillRule { FILL_NONZERO, FILL_EVEN_ODD };
+const int AA_STRIP = 32;
+
+struct AAEdge { float x0, y0, x1, y1; };   // cell coordinates: column c, row r is [c,c+1) x [r,r+1)
+
+// p[0..n) += v
+static inline void addConstant(float *p, int n, float v) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 vv = _mm_set1_ps(v);
+    for(; i + 4 <= n; i += 4) _mm_storeu_ps(p + i, _mm_add_ps(_mm_loadu_ps(p + i), vv));
+#endif
+    for(; i < n; ++i) p[i] += v;
+}
+
+// Split an edge where it leaves the columns [0, w] and push the pieces onto
+// out, with the parts outside flattened onto the border. A vertical piece on
+// x = 0 adds full cover to every cell right of it, exactly what the original
+// did, so coverage inside the box is unchanged.
+static void clipEdgeX(float ax, float ay, float bx, float by, float w, vector<AAEdge> &out) {
+    float t[4] = {0, 1, 1, 1};
+    int n = 1;
+    if(ax != bx) {
+        for(float edge : {0.0f, w}) {
+            float u = (edge - ax) / (bx - ax);
+            if(u > 0 && u < 1) t[n++] = u;
+        }
+    }
+    if(n == 3 && t[1] > t[2]) swap(t[1], t[2]);
+    t[n] = 1;
+    for(int i = 0; i < n; ++i) {
+        float ya = ay + (by - ay) * t[i], yb = ay + (by - ay) * t[i+1];
+        float xa = min(max(ax + (bx - ax) * t[i],   0.0f), w);
+        float xb = min(max(ax + (bx - ax) * t[i+1], 0.0f), w);
+        if(ya != yb) out.push_back({xa, ya, xb, yb});
+    }
+}
+
+// Add the signed area of edge e to rows [r0, r1) of acc (row r starts at
+// acc + (r - r0)*stride; stride >= box width + 2). Edges going up add,
+// edges going down subtract. lo/hi track the cells each row touched: left
+// of lo and right of hi the winding is 0, so only lo..hi need resolving.
+static void accumulateEdge(float *acc, int stride, int r0, int r1, const AAEdge &e, int *lo, int *hi) {
+    float ax = e.x0, ay = e.y0, bx = e.x1, by = e.y1, dir = 1.0f;
+    if(ay > by) { swap(ax, bx); swap(ay, by); dir = -1.0f; }
+    float ytop = max(ay, (float)r0), ybot = min(by, (float)r1);
+    if(ytop >= ybot) return;
+    float dxdy = (bx - ax) / (by - ay);
+    float x = ax + (ytop - ay) * dxdy;
+    for(int r = (int)ytop; r < ybot; ++r) {
+        float dy = min((float)(r + 1), ybot) - max((float)r, ytop);
+        float xnext = x + dxdy * dy;
+        float d = dy * dir;
+        float xa = min(x, xnext), xb = max(x, xnext);
+        float *row = acc + (size_t)(r - r0) * stride;
+        int ia = (int)xa, ib = (int)ceilf(xb);
+        lo[r - r0] = min(lo[r - r0], ia);
+        hi[r - r0] = max(hi[r - r0], max(ib, ia + 1));
+        if(ib <= ia + 1) {
+            // within one cell: cover splits between it and its right neighbour
+            float xm = 0.5f * (x + xnext) - ia;
+            row[ia]     += d - d * xm;
+            row[ia + 1] += d * xm;
+        } else {
+            // across several cells: triangle in the first and last, equal
+            // slices in between
+            float s = 1.0f / (xb - xa);
+            float fa = xa - ia, fb = xb - ib + 1;
+            float a0 = 0.5f * s * (1 - fa) * (1 - fa);
+            float am = 0.5f * s * fb * fb;
+            row[ia] += d * a0;
+            if(ib == ia + 2) {
+                row[ia + 1] += d * (1 - a0 - am);
+            } else {
+                float a1 = s * (1.5f - fa);
+                row[ia + 1] += d * (a1 - a0);
+                addConstant(row + ia + 2, ib - ia - 3, d * s);
+                float a2 = a1 + (ib - ia - 3) * s;
+                row[ib - 1] += d * (1 - a2 - am);
+            }
+            row[ib] += d * am;
+        }
+        x = xnext;
+    }
+}
+
+// Prefix-sum one accumulation row into 0..255 coverage and clear it for the
+// next strip.
+static void resolveRow(float *acc, int n, FillRule rule, unsigned char *cov) {
+    float sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), half = _mm_set1_ps(0.5f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    __m128 carry = _mm_setzero_ps();
+    for(; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(acc + i);
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+        v = _mm_add_ps(v, carry);
+        carry = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_storeu_ps(acc + i, _mm_setzero_ps());
+
+        __m128 a = _mm_and_ps(v, absMask);
+        if(rule == FILL_NONZERO) {
+            a = _mm_min_ps(a, one);
+        } else {
+            __m128 t = _mm_sub_ps(a, _mm_mul_ps(two, _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(a, half)))));
+            a = _mm_sub_ps(one, _mm_and_ps(_mm_sub_ps(t, one), absMask));
+        }
+        __m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(a, scale), half));
+        c = _mm_packs_epi32(c, c);
+        c = _mm_packus_epi16(c, c);
+        int packed = _mm_cvtsi128_si32(c);
+        memcpy(cov + i, &packed, 4);
+    }
+    sum = _mm_cvtss_f32(carry);
+#endif
+    for(; i < n; ++i) {
+        sum += acc[i];
+        acc[i] = 0;
+        float a = fabsf(sum);
+        if(rule == FILL_NONZERO) a = min(a, 1.0f);
+        else { float t = a - 2.0f * (int)(a * 0.5f); a = 1.0f - fabsf(t - 1.0f); }
+        cov[i] = (unsigned char)(a * 255.0f + 0.5f);
+    }
+}
+
+// Blend fillColor over the canvas with per-pixel coverage. Most of a row is
+// uncovered or fully covered; those runs are found 8 coverage bytes at a
+// time and skipped or filled in one go.
+static void blendRow(Color *dst, const unsigned char *cov, int n) {
+    const uint64_t FULL = ~(uint64_t)0;
+    auto word = [cov](int i) { uint64_t w; memcpy(&w, cov + i, 8); return w; };
+    int i = 0;
+    while(i < n) {
+        if(i + 8 <= n) {
+            uint64_t w = word(i);
+            if(w == 0) { i += 8; continue; }
+            if(w == FULL) {
+                int j = i + 8;
+                while(j + 8 <= n && word(j) == FULL) j += 8;
+                std::fill(dst + i, dst + j, fillColor);
+                i = j;
+                continue;
+            }
+        }
+        int c = cov[i];
+        if(c == 255) dst[i] = fillColor;
+        else if(c != 0) {
+            Color &d = dst[i];
+            d.r = (unsigned char)((d.r * (255 - c) + fillColor.r * c + 127) / 255);
+            d.g = (unsigned char)((d.g * (255 - c) + fillColor.g * c + 127) / 255);
+            d.b = (unsigned char)((d.b * (255 - c) + fillColor.b * c + 127) / 255);
+        }
+        ++i;
+    }
+}
+
+// Anti-aliased fill of polygonPts with fillColor under the given rule.
+// threads works as for scanlineFillPolygon.
+void coverageFillPolygon(FillRule rule, int threads = 1) {
+    if(polygonPts.size() < 3) return;
+    int minX = polygonPts[0].x, maxX = minX, minY = polygonPts[0].y, maxY = minY;
+    for(auto &p: polygonPts) {
+        minX = min(minX, p.x); maxX = max(maxX, p.x);
+        minY = min(minY, p.y); maxY = max(maxY, p.y);
+    }
+    minX = max(minX, 0); maxX = min(maxX, canvas.w-1);
+    minY = max(minY, 0); maxY = min(maxY, canvas.h-1);
+    if(minX > maxX || minY > maxY) return;
+
+    // Edges in cell coordinates of the box, bucketed by strip (each edge is
+    // listed in every strip it crosses)
+    int bw = maxX - minX + 1, rows = maxY - minY + 1;
+    int stride = (bw + 2 + 3) & ~3;
+    int nStrips = (rows + AA_STRIP - 1) / AA_STRIP;
+    vector<AAEdge> edges;
+    int n = polygonPts.size();
+    for(int i = 0; i < n; ++i) {
+        const Point &a = polygonPts[i], &b = polygonPts[(i+1)%n];
+        if(a.y == b.y) continue;
+        clipEdgeX(a.x + 0.5f - minX, a.y + 0.5f - minY, b.x + 0.5f - minX, b.y + 0.5f - minY, (float)bw, edges);
+    }
+    vector<int> stripStart(nStrips + 1, 0), stripEdges;
+    auto stripRange = [&](const AAEdge &e, int &s0, int &s1) {
+        float lo = max(min(e.y0, e.y1), 0.0f), hi = min(max(e.y0, e.y1), (float)rows);
+        s0 = (int)lo / AA_STRIP;
+        s1 = hi > lo ? min(((int)ceilf(hi) - 1) / AA_STRIP, nStrips - 1) : s0 - 1;
+    };
+    for(auto &e : edges) { int s0, s1; stripRange(e, s0, s1); for(int s = s0; s <= s1; ++s) stripStart[s+1]++; }
+    for(int s = 0; s < nStrips; ++s) stripStart[s+1] += stripStart[s];
+    stripEdges.resize(stripStart[nStrips]);
+    {
+        vector<int> fillPos(stripStart.begin(), stripStart.end() - 1);
+        for(int i = 0; i < (int)edges.size(); ++i) {
+            int s0, s1; stripRange(edges[i], s0, s1);
+            for(int s = s0; s <= s1; ++s) stripEdges[fillPos[s]++] = i;
+        }
+    }
+
+    if(threads <= 0) threads = max(1u, thread::hardware_concurrency());
+    threads = min(threads, nStrips);
+    atomic<int> next{0};
+    atomic<size_t> scratchBytes{0};
+    auto worker = [&]() {
+        vector<float> acc((size_t)stride * AA_STRIP, 0.0f);
+        vector<unsigned char> cov(stride);
+        int lo[AA_STRIP], hi[AA_STRIP];
+        for(int s; (s = next++) < nStrips; ) {
+            int r0 = s * AA_STRIP, r1 = min(r0 + AA_STRIP, rows);
+            fill(lo, lo + AA_STRIP, stride);
+            fill(hi, hi + AA_STRIP, -1);
+            for(int k = stripStart[s]; k < stripStart[s+1]; ++k)
+                accumulateEdge(acc.data(), stride, r0, r1, edges[stripEdges[k]], lo, hi);
+            for(int r = r0; r < r1; ++r) {
+                int a = lo[r - r0], b = hi[r - r0];
+                if(a > b) continue;
+                // resolving also clears the cells for the next strip; cells
+                // past the box (b >= bw) only ever hold cover for outside it
+                resolveRow(acc.data() + (size_t)(r - r0) * stride + a, b - a + 1, rule, cov.data() + a);
+                blendRow(canvas.row(minY + r) + minX + a, cov.data() + a, min(b, bw - 1) - a + 1);
+            }
+        }
+        scratchBytes += acc.capacity() * sizeof(float) + cov.capacity();
+    };
+    vector<thread> pool;
+    for(int t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for(auto &t : pool) t.join();
+    fillStats.auxBytes = max(fillStats.auxBytes, edges.capacity() * sizeof(AAEdge)
+                             + (stripStart.capacity() + stripEdges.capacity()) * sizeof(int) + scratchBytes);
 }
 
 // ---------- Flood Fill (iterative stack) ----------
 void floodFillIterative(int seedX, int seedY, const Color &targetColor, bool eightConnected) {
-    if(seedX<0||seedX>=winWidth||seedY<0||seedY>=winHeight) return;
+    if(seedX<0||seedX>=canvas.w||seedY<0||seedY>=canvas.h) return;
     Color orig = getPixel(seedX, seedY);
     if(orig == targetColor) return; // nothing to do
 
@@ -160,30 +679,34 @@ void floodFillIterative(int seedX, int seedY, const Color &targetColor, bool eig
     st.push({seedX, seedY});
 
     while(!st.empty()) {
+        fillStats.maxStack = max(fillStats.maxStack, st.size());
         Point p = st.top(); st.pop();
+        fillStats.pushes++;   // every pushed point is popped exactly once
+        fillStats.reads++;
         Color cur = getPixel(p.x, p.y);
         if(!(cur == orig)) continue; // skip changed or boundary
         setPixel(p.x, p.y, targetColor);
 
         // Push neighbors
         // 4-connected
-        if(p.x+1 < winWidth) st.push({p.x+1, p.y});
+        if(p.x+1 < canvas.w) st.push({p.x+1, p.y});
         if(p.x-1 >= 0) st.push({p.x-1, p.y});
-        if(p.y+1 < winHeight) st.push({p.x, p.y+1});
+        if(p.y+1 < canvas.h) st.push({p.x, p.y+1});
         if(p.y-1 >= 0) st.push({p.x, p.y-1});
         if(eightConnected) {
-            if(p.x+1 < winWidth && p.y+1 < winHeight) st.push({p.x+1, p.y+1});
-            if(p.x-1 >= 0 && p.y+1 < winHeight) st.push({p.x-1, p.y+1});
-            if(p.x+1 < winWidth && p.y-1 >= 0) st.push({p.x+1, p.y-1});
+            if(p.x+1 < canvas.w && p.y+1 < canvas.h) st.push({p.x+1, p.y+1});
+            if(p.x-1 >= 0 && p.y+1 < canvas.h) st.push({p.x-1, p.y+1});
+            if(p.x+1 < canvas.w && p.y-1 >= 0) st.push({p.x+1, p.y-1});
             if(p.x-1 >= 0 && p.y-1 >= 0) st.push({p.x-1, p.y-1});
         }
     }
-    glFlush();
+    fillStats.auxBytes = max(fillStats.auxBytes, fillStats.maxStack * sizeof(Point));
 }
 
 // ---------- Boundary Fill (iterative) ----------
-void boundaryFillIterative(int seedX, int seedY, const Color &fillCol, const Color &boundaryCol) {
-    if(seedX<0||seedX>=winWidth||seedY<0||seedY>=winHeight) return;
+void boundaryFillIterative(int seedX, int seedY, const Color &fillCol, const Color &boundaryCol,
+                           bool eightConnected = false) {
+    if(seedX<0||seedX>=canvas.w||seedY<0||seedY>=canvas.h) return;
     Color cur = getPixel(seedX, seedY);
     if(cur == boundaryCol || cur == fillCol) return;
 
@@ -191,39 +714,755 @@ void boundaryFillIterative(int seedX, int seedY, const Color &fillCol, const Col
     st.push({seedX, seedY});
 
     while(!st.empty()) {
+        fillStats.maxStack = max(fillStats.maxStack, st.size());
         Point p = st.top(); st.pop();
+        fillStats.pushes++;   // every pushed point is popped exactly once
+        fillStats.reads++;
         Color c = getPixel(p.x, p.y);
         if(c == boundaryCol || c == fillCol) continue;
         setPixel(p.x, p.y, fillCol);
 
-        // 4-connected neighbors (we'll use 8 if desired but classic boundary is 4)
-        if(p.x+1 < winWidth) st.push({p.x+1, p.y});
+        // 4-connected neighbors (classic boundary fill), diagonals on request
+        if(p.x+1 < canvas.w) st.push({p.x+1, p.y});
         if(p.x-1 >= 0) st.push({p.x-1, p.y});
-        if(p.y+1 < winHeight) st.push({p.x, p.y+1});
+        if(p.y+1 < canvas.h) st.push({p.x, p.y+1});
         if(p.y-1 >= 0) st.push({p.x, p.y-1});
+        if(eightConnected) {
+            if(p.x+1 < canvas.w && p.y+1 < canvas.h) st.push({p.x+1, p.y+1});
+            if(p.x-1 >= 0 && p.y+1 < canvas.h) st.push({p.x-1, p.y+1});
+            if(p.x+1 < canvas.w && p.y-1 >= 0) st.push({p.x+1, p.y-1});
+            if(p.x-1 >= 0 && p.y-1 >= 0) st.push({p.x-1, p.y-1});
+        }
     }
-    glFlush();
+    fillStats.auxBytes = max(fillStats.auxBytes, fillStats.maxStack * sizeof(Point));
+}
+
+// ---------- Span (scanline seed) fill ----------
+// Smith's seed fill: pop a seed, grow it into the whole horizontal run of
+// fillable pixels, fill the run, then scan the rows above and below (one
+// pixel wider on each side when 8-connected) and push a single seed for each
+// fillable run found there. The stack holds runs instead of pixels and each
+// pixel is read a small constant number of times. `inside` must be false for
+// fillCol so that runs reached twice are skipped. The filled region is the
+// same connected component the per-pixel fills produce.
+template<class Inside>
+void spanFill(int seedX, int seedY, const Color &fillCol, bool eightConnected, Inside inside) {
+    const int W = canvas.w, H = canvas.h;
+    stack<Point, vector<Point>> st;
+    st.push({seedX, seedY});
+    fillStats.pushes++;
+
+    while(!st.empty()) {
+        fillStats.maxStack = max(fillStats.maxStack, st.size());
+        Point p = st.top(); st.pop();
+        Color *row = canvas.row(p.y);
+        int xl = p.x, xr = p.x;
+        fillStats.reads++;
+        if(!inside(row[xl])) continue;
+        while(xl > 0 && inside(row[xl-1])) --xl;
+        while(xr < W-1 && inside(row[xr+1])) ++xr;
+        fillStats.reads += (xr - xl) + (xl > 0) + (xr < W-1);
+        std::fill(row + xl, row + xr + 1, fillCol);
+
+        int lo = eightConnected ? max(xl-1, 0) : xl;
+        int hi = eightConnected ? min(xr+1, W-1) : xr;
+        for(int ny = p.y-1; ny <= p.y+1; ny += 2) {
+            if(ny < 0 || ny >= H) continue;
+            const Color *nrow = canvas.row(ny);
+            bool inRun = false;
+            for(int x = lo; x <= hi; ++x) {
+                bool in = inside(nrow[x]);
+                if(in && !inRun) { st.push({x, ny}); fillStats.pushes++; }
+                inRun = in;
+            }
+            fillStats.reads += hi - lo + 1;
+        }
+    }
+    fillStats.auxBytes = max(fillStats.auxBytes, fillStats.maxStack * sizeof(Point));
+}
+
+void floodFillSpan(int seedX, int seedY, const Color &targetColor, bool eightConnected) {
+    if(seedX<0||seedX>=canvas.w||seedY<0||seedY>=canvas.h) return;
+    Color orig = getPixel(seedX, seedY);
+    if(orig == targetColor) return;
+    spanFill(seedX, seedY, targetColor, eightConnected,
+             [orig](const Color &c){ return c == orig; });
+}
+
+void boundaryFillSpan(int seedX, int seedY, const Color &fillCol, const Color &boundaryCol,
+                      bool eightConnected = false) {
+    if(seedX<0||seedX>=canvas.w||seedY<0||seedY>=canvas.h) return;
+    Color cur = getPixel(seedX, seedY);
+    if(cur == boundaryCol || cur == fillCol) return;
+    spanFill(seedX, seedY, fillCol, eightConnected,
+             [fillCol, boundaryCol](const Color &c){ return !(c == boundaryCol || c == fillCol); });
 }
 
+// ---------- Tiled out-of-core canvas ----------
+// An image too big to hold in RAM, kept in a file as square tiles of
+// 2^tileShift pixels. Tiles are stored tile-major, each page aligned, behind
+// a page-sized header. At most `cacheTiles` of them are mapped at a time;
+// touching another one unmaps the least recently used tile (the kernel
+// writes its dirty pages back to the file), so resident memory is bounded by
+// the cache, not by the image.
+struct TileFileHeader { char magic[8]; uint32_t w, h, tileShift, pad; };
+static const char TILE_MAGIC[8] = {'L','A','B','7','T','I','L','E'};
+static const size_t TILE_DATA_OFFSET = 4096;
+
+struct TiledCanvas {
+    int w = 0, h = 0, tileShift = 0, tile = 0, tilesX = 0, tilesY = 0;
+    size_t tileBytes = 0;                 // one tile in the file, rounded up to pages
+    size_t loads = 0, evictions = 0;
+
+    TiledCanvas() = default;
+    TiledCanvas(const TiledCanvas &) = delete;
+    TiledCanvas &operator=(const TiledCanvas &) = delete;
+    ~TiledCanvas() { close(); }
+
+    // Create (or overwrite) a W x H image at path, every pixel bg
+    bool create(const char *path, int W, int H, int tileShift, const Color &bg, int cacheTiles) {
+        close();
+        fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) { cerr << "cannot create " << path << "\n"; return false; }
+        TileFileHeader hd{};
+        memcpy(hd.magic, TILE_MAGIC, sizeof(hd.magic));
+        hd.w = W; hd.h = H; hd.tileShift = tileShift;
+        setup(W, H, tileShift, cacheTiles);
+        vector<Color> buf(tileBytes / sizeof(Color) + 1, bg);
+        bool ok = pwrite(fd, &hd, sizeof(hd), 0) == (ssize_t)sizeof(hd)
+               && ftruncate(fd, TILE_DATA_OFFSET + tileBytes * tilesX * tilesY) == 0;
+        for(int t = 0; ok && t < tilesX * tilesY; ++t)
+            ok = pwrite(fd, buf.data(), tileBytes, TILE_DATA_OFFSET + tileBytes * t) == (ssize_t)tileBytes;
+        if(!ok) { cerr << "cannot write " << path << "\n"; close(); }
+        return ok;
+    }
+
+    bool open(const char *path, int cacheTiles) {
+        close();
+        fd = ::open(path, O_RDWR);
+        if(fd < 0) { cerr << "cannot open " << path << "\n"; return false; }
+        TileFileHeader hd;
+        struct stat st;
+        bool ok = pread(fd, &hd, sizeof(hd), 0) == (ssize_t)sizeof(hd)
+               && memcmp(hd.magic, TILE_MAGIC, sizeof(hd.magic)) == 0
+               && hd.w > 0 && hd.h > 0 && hd.w <= INT32_MAX && hd.h <= INT32_MAX
+               && hd.tileShift >= 4 && hd.tileShift <= 12 && fstat(fd, &st) == 0;
+        if(ok) {
+            setup(hd.w, hd.h, hd.tileShift, cacheTiles);
+            ok = (size_t)st.st_size >= TILE_DATA_OFFSET + tileBytes * tilesX * tilesY;
+        }
+        if(!ok) { cerr << path << ": not a tiled canvas\n"; close(); }
+        return ok;
+    }
+
+    // Unmap every cached tile and close the file
+    void close() {
+        for(auto &s : slots) if(s.px) munmap(s.px, tileBytes);
+        slots.clear(); slotOf.clear();
+        head = tail = lastTile = -1;
+        if(fd >= 0) ::close(fd);
+        fd = -1;
+    }
+
+    int tileOf(int x, int y) const { return (y >> tileShift) * tilesX + (x >> tileShift); }
+    int tileX0(int t) const { return t % tilesX << tileShift; }
+    int tileY0(int t) const { return t / tilesX << tileShift; }
+    bool resident(int t) const { return slotOf[t] >= 0; }
+
+    // Pixels of tile t, row-major with a stride of `tile`; the pointer stays
+    // valid until cacheTiles other tiles have been touched.
+    Color *tilePixels(int t) {
+        if(t == lastTile) return lastPx;
+        int s = slotOf[t];
+        if(s < 0) {
+            if((int)slots.size() < cap) { s = slots.size(); slots.push_back({-1, nullptr, -1, -1}); }
+            else {
+                s = tail;           // evict the least recently used tile
+                unlink(s);
+                munmap(slots[s].px, tileBytes);
+                slotOf[slots[s].t] = -1;
+                ++evictions;
+            }
+            void *p = mmap(nullptr, tileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                           TILE_DATA_OFFSET + tileBytes * t);
+            if(p == MAP_FAILED) { cerr << "cannot map tile " << t << "\n"; exit(1); }
+            slots[s].t = t; slots[s].px = (Color *)p;
+            slotOf[t] = s;
+            ++loads;
+        } else unlink(s);
+        pushFront(s);
+        lastTile = t; lastPx = slots[s].px;
+        return lastPx;
+    }
+
+    // Call f(tile) for every cached tile, most recently used first
+    template<class F> void forEachResident(F f) const { for(int s = head; s >= 0; s = slots[s].next) f(slots[s].t); }
+
+    Color get(int x, int y) { return tilePixels(tileOf(x, y))[localIndex(x, y)]; }
+    void set(int x, int y, const Color &c) {
+        if(x<0 || x>=w || y<0 || y>=h) return;
+        tilePixels(tileOf(x, y))[localIndex(x, y)] = c;
+    }
+    int localIndex(int x, int y) const { return ((y & (tile-1)) << tileShift) | (x & (tile-1)); }
+
+private:
+    struct Slot { int t; Color *px; int prev, next; };
+    int fd = -1, cap = 0, head = -1, tail = -1, lastTile = -1;
+    Color *lastPx = nullptr;
+    vector<Slot> slots;                   // cached tiles, linked most recent first
+    vector<int> slotOf;                   // tile -> slot, -1 if not mapped
+
+    void setup(int W, int H, int shift, int cacheTiles) {
+        w = W; h = H; tileShift = shift; tile = 1 << shift;
+        tilesX = (W + tile - 1) >> shift; tilesY = (H + tile - 1) >> shift;
+        long page = sysconf(_SC_PAGESIZE);
+        tileBytes = ((size_t)tile * tile * sizeof(Color) + page - 1) / page * page;
+        cap = max(1, cacheTiles);
+        slotOf.assign((size_t)tilesX * tilesY, -1);
+        loads = evictions = 0;
+    }
+    void unlink(int s) {
+        Slot &sl = slots[s];
+        (sl.prev >= 0 ? slots[sl.prev].next : head) = sl.next;
+        (sl.next >= 0 ? slots[sl.next].prev : tail) = sl.prev;
+    }
+    void pushFront(int s) {
+        slots[s].prev = -1; slots[s].next = head;
+        (head >= 0 ? slots[head].prev : tail) = s;
+        head = s;
+    }
+};
+
+// Per-pixel seed fill on a tiled canvas, the out-of-core counterpart of the
+// iterative stack fills. A 1-bit-per-pixel visited bitmap (anonymous mapping,
+// tile-major, only touched pages become resident) marks pixels when they are
+// queued, so each pixel is examined once. Work is kept per tile: a neighbour
+// in the current tile goes on the local stack, one in another tile goes on
+// that tile's pending list without touching its pixels. A tile is drained
+// completely before moving on, and the next tile is one with pending work
+// that is still cached if possible, else the oldest waiting one. Only one
+// tile's pixels are needed at a time and every queue entry is a distinct
+// pixel, so memory stays bounded by the cache plus the fill's frontier.
+// Returns the number of pixels filled.
+template<class Inside>
+size_t tiledSeedFill(TiledCanvas &tc, int seedX, int seedY, const Color &fillCol, bool eightConnected, Inside inside) {
+    const int nTiles = tc.tilesX * tc.tilesY, tilePix = tc.tile * tc.tile, mask = tc.tile - 1;
+    size_t bitmapBytes = ((size_t)nTiles * tilePix + 7) / 8;
+    uint8_t *visited = (uint8_t *)mmap(nullptr, bitmapBytes, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(visited == MAP_FAILED) { cerr << "cannot map visited bitmap\n"; return 0; }
+
+    vector<vector<uint32_t>> pending(nTiles);   // local pixel indices per tile
+    vector<char> waiting(nTiles, 0);
+    deque<int> ready;
+    vector<uint32_t> st;
+    size_t queued = 0, filled = 0;
+
+    // mark (x, y) visited; queue it unless it already was
+    auto visit = [&](int x, int y, int cur) {
+        int t = tc.tileOf(x, y);
+        uint32_t li = tc.localIndex(x, y);
+        size_t bit = (size_t)t * tilePix + li;
+        if(visited[bit >> 3] & (1 << (bit & 7))) return;
+        visited[bit >> 3] |= 1 << (bit & 7);
+        fillStats.pushes++;
+        if(t == cur) { st.push_back(li); return; }
+        pending[t].push_back(li);
+        ++queued;
+        if(!waiting[t]) { waiting[t] = 1; ready.push_back(t); }
+    };
+    visit(seedX, seedY, -1);
+
+    for(;;) {
+        int t = -1;
+        tc.forEachResident([&](int r){ if(t < 0 && waiting[r]) t = r; });
+        while(t < 0 && !ready.empty()) {
+            if(waiting[ready.front()]) t = ready.front();
+            ready.pop_front();
+        }
+        if(t < 0) break;
+        waiting[t] = 0;
+        queued -= pending[t].size();
+        st.assign(pending[t].begin(), pending[t].end());
+        vector<uint32_t>().swap(pending[t]);   // drained lists give their memory back
+
+        Color *px = tc.tilePixels(t);
+        const int x0 = tc.tileX0(t), y0 = tc.tileY0(t);
+        while(!st.empty()) {
+            fillStats.maxStack = max(fillStats.maxStack, st.size() + queued);
+            uint32_t li = st.back(); st.pop_back();
+            fillStats.reads++;
+            if(!inside(px[li])) continue;
+            px[li] = fillCol;
+            ++filled;
+
+            int x = x0 + (int)(li & mask), y = y0 + (int)(li >> tc.tileShift);
+            if(x+1 < tc.w) visit(x+1, y, t);
+            if(x-1 >= 0) visit(x-1, y, t);
+            if(y+1 < tc.h) visit(x, y+1, t);
+            if(y-1 >= 0) visit(x, y-1, t);
+            if(eightConnected) {
+                if(x+1 < tc.w && y+1 < tc.h) visit(x+1, y+1, t);
+                if(x-1 >= 0 && y+1 < tc.h) visit(x-1, y+1, t);
+                if(x+1 < tc.w && y-1 >= 0) visit(x+1, y-1, t);
+                if(x-1 >= 0 && y-1 >= 0) visit(x-1, y-1, t);
+            }
+        }
+    }
+    munmap(visited, bitmapBytes);
+    fillStats.auxBytes = max(fillStats.auxBytes, fillStats.maxStack * sizeof(uint32_t));
+    return filled;
+}
+
+size_t floodFillIterative(TiledCanvas &tc, int seedX, int seedY, const Color &targetColor, bool eightConnected) {
+    if(seedX<0||seedX>=tc.w||seedY<0||seedY>=tc.h) return 0;
+    Color orig = tc.get(seedX, seedY);
+    if(orig == targetColor) return 0;
+    return tiledSeedFill(tc, seedX, seedY, targetColor, eightConnected,
+                         [orig](const Color &c){ return c == orig; });
+}
+
+size_t boundaryFillIterative(TiledCanvas &tc, int seedX, int seedY, const Color &fillCol, const Color &boundaryCol,
+                             bool eightConnected = false) {
+    if(seedX<0||seedX>=tc.w||seedY<0||seedY>=tc.h) return 0;
+    Color cur = tc.get(seedX, seedY);
+    if(cur == boundaryCol || cur == fillCol) return 0;
+    return tiledSeedFill(tc, seedX, seedY, fillCol, eightConnected,
+                         [fillCol, boundaryCol](const Color &c){ return !(c == boundaryCol || c == fillCol); });
+}
+
+// ---------- Benchmark ----------
+double msSince(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+size_t countPixels(const Color &c) {
+    return (size_t)count(canvas.px.begin(), canvas.px.end(), c);
+}
+
+// Every fill the benchmarks run. `ref` is the fill whose result this one
+// must reproduce pixel for pixel (-1: none).
+struct FillMethod { const char *name; int ref; };
+const FillMethod fillMethods[] = {
+    {"scanline", -1}, {"flood4", -1}, {"flood8", -1}, {"boundary4", 1}, {"boundary8", 2},
+    {"span_flood4", 1}, {"span_flood8", 2}, {"span_boundary4", 3}, {"span_boundary8", 4},
+};
+const int nFillMethods = sizeof(fillMethods) / sizeof(fillMethods[0]);
+
+void runFillMethod(int m, int sx, int sy) {
+    switch(m) {
+        case 0: scanlineFillPolygon(); break;
+        case 1: floodFillIterative(sx, sy, fillColor, false); break;
+        case 2: floodFillIterative(sx, sy, fillColor, true); break;
+        case 3: boundaryFillIterative(sx, sy, fillColor, polygonColor, false); break;
+        case 4: boundaryFillIterative(sx, sy, fillColor, polygonColor, true); break;
+        case 5: floodFillSpan(sx, sy, fillColor, false); break;
+        case 6: floodFillSpan(sx, sy, fillColor, true); break;
+        case 7: boundaryFillSpan(sx, sy, fillColor, polygonColor, false); break;
+        case 8: boundaryFillSpan(sx, sy, fillColor, polygonColor, true); break;
+    }
+}
+
+// Fill a WxH region with every algorithm and print the timings as CSV. Two
+// outlines: the canvas border ("rect", each fill covers ~W*H pixels) and a
+// concave 9-point star. Seed fills are checked pixel for pixel against the
+// fill they must reproduce.
+void benchFill(int W, int H) {
+    canvas.resize(W, H, backgroundColor);
+    winWidth = W; winHeight = H;
+    polygonFinished = true;
+
+    cout << "shape,fill,width,height,ms,pixels,Mpix_per_s,peak_stack,reads_per_px,match\n";
+    for(int shape = 0; shape < 2; ++shape) {
+        polygonPts.clear();
+        if(shape == 0) {
+            polygonPts = { {0,0}, {W-1,0}, {W-1,H-1}, {0,H-1} };
+        } else {
+            double R = 0.48 * min(W, H);
+            for(int i = 0; i < 18; ++i) {
+                double r = (i % 2) ? 0.35 * R : R, a = M_PI * i / 9.0;
+                polygonPts.push_back({ W/2 + (int)lround(r * sin(a)), H/2 + (int)lround(r * cos(a)) });
+            }
+        }
+        vector<vector<Color>> results(nFillMethods);
+        for(int m = 0; m < nFillMethods; ++m) {
+            clearWindow();
+            drawOutlineToCanvas();
+            fillStats = FillStats();
+            auto t0 = chrono::steady_clock::now();
+            runFillMethod(m, W/2, H/2);
+            double ms = msSince(t0);
+            results[m] = canvas.px;
+            size_t n = countPixels(fillColor);
+            int ref = fillMethods[m].ref;
+            cout << (shape ? "star" : "rect") << ',' << fillMethods[m].name << ',' << W << ',' << H << ','
+                 << ms << ',' << n << ',' << n / (ms * 1000.0) << ',';
+            if(m == 0) cout << "-,-,-\n";
+            else cout << fillStats.maxStack << ',' << (double)fillStats.reads / max<size_t>(n, 1) << ','
+                      << (ref < 0 ? "-" : results[ref] == results[m] ? "yes" : "NO") << '\n';
+        }
+    }
+}
+
+// Random polygon of V vertices centred on a WxH canvas, spanning ~90% of it:
+//   convex  - random angles on an ellipse
+//   concave - random angles, each vertex at a random 25..100% of the radius
+//   star    - evenly spaced, alternating full and 45% radius, random rotation
+// All three are star-shaped around the centre, so the centre is an interior
+// seed for the flood and boundary fills.
+enum PolyKind { POLY_CONVEX, POLY_CONCAVE, POLY_STAR };
+const char *polyKindNames[] = {"convex", "concave", "star"};
+
+vector<Point> randomPolygon(PolyKind kind, int V, int W, int H, mt19937 &rng) {
+    uniform_real_distribution<double> u(0.0, 1.0);
+    vector<double> ang(V);
+    if(kind == POLY_STAR) {
+        double rot = 2 * M_PI * u(rng);
+        for(int i = 0; i < V; ++i) ang[i] = rot + 2 * M_PI * i / V;
+    } else {
+        for(auto &a : ang) a = 2 * M_PI * u(rng);
+        sort(ang.begin(), ang.end());
+    }
+    vector<Point> pts;
+    for(int i = 0; i < V; ++i) {
+        double r = kind == POLY_CONVEX ? 1.0 : kind == POLY_STAR ? ((i % 2) ? 0.45 : 1.0) : 0.25 + 0.75 * u(rng);
+        pts.push_back({ W/2 + (int)lround(0.45 * W * r * cos(ang[i])),
+                        H/2 + (int)lround(0.45 * H * r * sin(ang[i])) });
+    }
+    return pts;
+}
+
+// Headless benchmark over `count` random polygons of each kind: every fill
+// runs on the polygon's outline from the centre seed. CSV columns:
+//   ms, pixels filled, Mpix/s, aux_bytes (peak stack or edge table memory),
+//   agree_pct   - % of canvas pixels whose covered/uncovered state (outline
+//                 or fill vs background) matches the scanline fill,
+//   ref / identical - the fill this one must reproduce and whether it does.
+void benchPolygons(int V, int W, int H, int count, unsigned seed) {
+    canvas.resize(W, H, backgroundColor);
+    winWidth = W; winHeight = H;
+    polygonFinished = true;
+    mt19937 rng(seed);
+
+    cout << "kind,poly,vertices,width,height,fill,ms,pixels,Mpix_per_s,aux_bytes,agree_pct,ref,identical\n";
+    for(int kind = POLY_CONVEX; kind <= POLY_STAR; ++kind) {
+        for(int poly = 0; poly < count; ++poly) {
+            polygonPts = randomPolygon((PolyKind)kind, V, W, H, rng);
+            vector<vector<Color>> results(nFillMethods);
+            for(int m = 0; m < nFillMethods; ++m) {
+                clearWindow();
+                drawOutlineToCanvas();
+                fillStats = FillStats();
+                auto t0 = chrono::steady_clock::now();
+                runFillMethod(m, W/2, H/2);
+                double ms = msSince(t0);
+                results[m] = canvas.px;
+
+                size_t n = countPixels(fillColor), same = 0;
+                const vector<Color> &scan = results[0];
+                for(size_t i = 0; i < canvas.px.size(); ++i)
+                    same += (canvas.px[i] == backgroundColor) == (scan[i] == backgroundColor);
+                int ref = fillMethods[m].ref;
+                cout << polyKindNames[kind] << ',' << poly << ',' << V << ',' << W << ',' << H << ','
+                     << fillMethods[m].name << ',' << ms << ',' << n << ',' << n / (ms * 1000.0) << ','
+                     << fillStats.auxBytes << ',' << 100.0 * same / canvas.px.size() << ','
+                     << (ref < 0 ? "-" : fillMethods[ref].name) << ','
+                     << (ref < 0 ? "-" : results[ref] == results[m] ? "yes" : "NO") << '\n';
+            }
+        }
+    }
+}
+
+// Star-shaped polygon of V vertices around the centre of an SxS canvas:
+// alternating outer/inner radius, or per-vertex random radii ("jagged").
+vector<Point> starPolygon(int V, int S, bool jagged, unsigned seed = 1) {
+    vector<Point> pts;
+    for(int i = 0; i < V; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        double u = (seed >> 8) / 16777216.0;
+        double r = jagged ? (0.15 + 0.34 * u) * S : ((i % 2) ? 0.30 * S : 0.49 * S);
+        double a = 2 * M_PI * i / V;
+        pts.push_back({ S/2 + (int)lround(r * sin(a)), S/2 + (int)lround(r * cos(a)) });
+    }
+    return pts;
+}
+
+// Scanline fill on an SxS canvas: first single-threaded throughput for star
+// and jagged polygons of 64..16384 vertices, then the banded fill of a
+// 256-point star on 1..N threads (N = 0: all cores). Best of 5 runs each;
+// every multi-threaded result must equal the single-threaded one.
+void benchScanline(int maxThreads, int S = 4000) {
+    if(maxThreads <= 0) maxThreads = max(1u, thread::hardware_concurrency());
+    canvas.resize(S, S, backgroundColor);
+
+    cout << "shape,vertices,ms,pixels,Mpix_per_s\n";
+    for(int jagged = 0; jagged < 2; ++jagged) {
+        for(int V : {64, 1024, 4096, 16384}) {
+            polygonPts = starPolygon(V, S, jagged);
+            double best = 1e30;
+            for(int rep = 0; rep < 5; ++rep) {
+                clearWindow();
+                auto t0 = chrono::steady_clock::now();
+                scanlineFillPolygon(1);
+                best = min(best, msSince(t0));
+            }
+            size_t n = countPixels(fillColor);
+            cout << (jagged ? "jagged" : "star") << ',' << V << ',' << best << ',' << n << ','
+                 << n / (best * 1000.0) << '\n';
+        }
+    }
+
+    polygonPts = starPolygon(256, S, false);
+    vector<Color> ref;
+    double base = 0;
+    cout << "\nthreads,ms,speedup,identical\n";
+    for(int t = 1; t <= maxThreads; ++t) {
+        double best = 1e30;
+        for(int rep = 0; rep < 5; ++rep) {
+            clearWindow();
+            auto t0 = chrono::steady_clock::now();
+            scanlineFillPolygon(t);
+            best = min(best, msSince(t0));
+        }
+        if(t == 1) { ref = canvas.px; base = best; }
+        cout << t << ',' << best << ',' << base / best << ',' << (canvas.px == ref ? "yes" : "NO") << '\n';
+    }
+}
+// Batch fill throughput on a WxH canvas for a "small" workload (20000
+// polygons of 3-12 vertices, radius 4-20) and a "large" one (500 polygons of
+// 16-64 vertices, radius 50-400), random centres and colours. The sequential
+// row fills them one at a time with scanlineFillPolygon; the batch rows use a
+// BatchFiller on 1..N threads (N = 0: all cores), best of 5 after one warm-up
+// fill, and must reproduce the sequential canvas. arena_growth is how much the
+// arena grew over the timed fills (0 = no steady-state allocation).
+void benchBatch(int maxThreads, int W, int H, unsigned seed) {
+    if(maxThreads <= 0) maxThreads = max(1u, thread::hardware_concurrency());
+    canvas.resize(W, H, backgroundColor);
+    mt19937 rng(seed);
+    struct Workload { const char *name; int count, minV, maxV, minR, maxR; };
+    const Workload loads[] = { {"small", 20000, 3, 12, 4, 20}, {"large", 500, 16, 64, 50, 400} };
+
+    cout << "workload,polygons,method,threads,ms,polys_per_s,arena_bytes,arena_growth,identical\n";
+    for(const Workload &wl : loads) {
+        vector<Point> pts;
+        vector<PolygonRef> polys;
+        vector<int> sizes;
+        for(int p = 0; p < wl.count; ++p) {
+            int V = uniform_int_distribution<int>(wl.minV, wl.maxV)(rng);
+            double R = uniform_int_distribution<int>(wl.minR, wl.maxR)(rng);
+            int cx = uniform_int_distribution<int>(0, W-1)(rng), cy = uniform_int_distribution<int>(0, H-1)(rng);
+            vector<double> ang(V);
+            for(auto &a : ang) a = 2 * M_PI * uniform_real_distribution<double>(0, 1)(rng);
+            sort(ang.begin(), ang.end());
+            for(double a : ang) {
+                double r = R * uniform_real_distribution<double>(0.3, 1.0)(rng);
+                pts.push_back({ cx + (int)lround(r * cos(a)), cy + (int)lround(r * sin(a)) });
+            }
+            sizes.push_back(V);
+            polys.push_back({ nullptr, V, { (unsigned char)rng(), (unsigned char)rng(), (unsigned char)rng() } });
+        }
+        for(size_t p = 0, off = 0; p < polys.size(); off += sizes[p++]) polys[p].pts = pts.data() + off;
+
+        Color savedFill = fillColor;
+        double seqMs = 1e30;
+        for(int rep = 0; rep < 3; ++rep) {
+            clearWindow();
+            auto t0 = chrono::steady_clock::now();
+            for(auto &pr : polys) {
+                polygonPts.assign(pr.pts, pr.pts + pr.n);
+                fillColor = pr.color;
+                scanlineFillPolygon(1);
+            }
+            seqMs = min(seqMs, msSince(t0));
+        }
+        fillColor = savedFill;
+        vector<Color> ref = canvas.px;
+        cout << wl.name << ',' << wl.count << ",sequential,1," << seqMs << ',' << wl.count / (seqMs / 1000.0)
+             << ",-,-,-\n";
+
+        for(int t = 1; t <= maxThreads; ++t) {
+            BatchFiller batch(t);
+            clearWindow();
+            batch.fill(polys.data(), polys.size());
+            size_t arena = batch.arenaBytes();
+            double best = 1e30;
+            for(int rep = 0; rep < 5; ++rep) {
+                clearWindow();
+                auto t0 = chrono::steady_clock::now();
+                batch.fill(polys.data(), polys.size());
+                best = min(best, msSince(t0));
+            }
+            cout << wl.name << ',' << wl.count << ",batch," << t << ',' << best << ',' << wl.count / (best / 1000.0)
+                 << ',' << arena << ',' << batch.arenaBytes() - arena << ',' << (canvas.px == ref ? "yes" : "NO") << '\n';
+        }
+    }
+}
+// peak resident set size of the whole process so far, in MB
+double peakRssMB() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0;
+}
+
+// Out-of-core fills on a WxH tiled canvas in `path`: the outline of a random
+// concave polygon of V vertices is drawn into a fresh file, then flood fill
+// (red) and boundary fill (blue) run from the centre with 2^tileShift pixel
+// tiles and a cache of cacheTiles tiles. peak_rss_mb is the process peak so
+// far, image_mb what the image would take in RAM. Images up to 4096x4096 are
+// also filled in memory with the span fills and must match; the file is
+// removed afterwards.
+void benchTiled(int W, int H, int V, int tileShift, int cacheTiles, const char *path, unsigned seed) {
+    mt19937 rng(seed);
+    vector<Point> pts = randomPolygon(POLY_CONCAVE, V, W, H, rng);
+    const Color blue = {0, 0, 255};
+    TiledCanvas tc;
+    auto t0 = chrono::steady_clock::now();
+    if(!tc.create(path, W, H, tileShift, backgroundColor, cacheTiles)) return;
+    double createMs = msSince(t0);
+    for(size_t i = 0; i < pts.size(); ++i) {
+        const Point &a = pts[i], &b = pts[(i+1) % pts.size()];
+        plotLine(a.x, a.y, b.x, b.y, [&](int x, int y){ tc.set(x, y, polygonColor); });
+    }
+    cerr << "created " << W << "x" << H << " image in " << createMs << " ms\n";
+
+    cout << "fill,width,height,tile,cache_tiles,ms,pixels,Mpix_per_s,tile_loads,evictions,queue_peak_bytes,"
+            "peak_rss_mb,image_mb\n";
+    size_t counts[2];
+    for(int f = 0; f < 2; ++f) {
+        fillStats = FillStats();
+        size_t loads = tc.loads, evictions = tc.evictions;
+        t0 = chrono::steady_clock::now();
+        counts[f] = f == 0 ? floodFillIterative(tc, W/2, H/2, fillColor, false)
+                           : boundaryFillIterative(tc, W/2, H/2, blue, polygonColor, false);
+        double ms = msSince(t0);
+        cout << (f == 0 ? "flood4" : "boundary4") << ',' << W << ',' << H << ',' << tc.tile << ','
+             << cacheTiles << ',' << ms << ',' << counts[f] << ',' << counts[f] / (ms * 1000.0) << ','
+             << tc.loads - loads << ',' << tc.evictions - evictions << ',' << fillStats.auxBytes << ','
+             << peakRssMB() << ',' << (double)W * H * sizeof(Color) / (1 << 20) << '\n';
+    }
+    tc.close();
+
+    if((size_t)W * H <= (size_t)4096 * 4096) {
+        canvas.resize(W, H, backgroundColor);
+        polygonPts = pts;
+        drawOutlineToCanvas();
+        floodFillSpan(W/2, H/2, fillColor, false);
+        bool same = countPixels(fillColor) == counts[0];
+        boundaryFillSpan(W/2, H/2, blue, polygonColor, false);
+        same = same && countPixels(blue) == counts[1] && tc.open(path, cacheTiles);
+        for(int y = 0; same && y < H; ++y)
+            for(int x = 0; x < W; ++x) same = same && tc.get(x, y) == canvas.px[(size_t)y * W + x];
+        tc.close();
+        cout << "identical to in-memory span fills: " << (same ? "yes" : "NO") << '\n';
+    }
+    unlink(path);
+}
+
+// Per-pixel coverage of polygonPts estimated with NxN point samples, each
+// classified exactly by winding number. Reference for --bench-aa.
+vector<float> referenceCoverage(FillRule rule, int N) {
+    int W = canvas.w, H = canvas.h, n = polygonPts.size();
+    vector<float> cov((size_t)W * H, 0.0f);
+    vector<pair<double,int>> xs;
+    for(int y = 0; y < H; ++y) {
+        for(int j = 0; j < N; ++j) {
+            double sy = y - 0.5 + (j + 0.5) / N;
+            xs.clear();
+            for(int i = 0; i < n; ++i) {
+                const Point &a = polygonPts[i], &b = polygonPts[(i+1)%n];
+                if(a.y == b.y || sy < min(a.y, b.y) || sy >= max(a.y, b.y)) continue;
+                xs.push_back({ a.x + (sy - a.y) * (b.x - a.x) / (double)(b.y - a.y), a.y < b.y ? 1 : -1 });
+            }
+            sort(xs.begin(), xs.end());
+            size_t k = 0;
+            int wind = 0;
+            for(int x = 0; x < W; ++x) {
+                for(int i = 0; i < N; ++i) {
+                    double sx = x - 0.5 + (i + 0.5) / N;
+                    for(; k < xs.size() && xs[k].first < sx; ++k) wind += xs[k].second;
+                    if(rule == FILL_NONZERO ? wind != 0 : (wind & 1)) cov[(size_t)y * W + x] += 1.0f / (N * N);
+                }
+            }
+        }
+    }
+    return cov;
+}
+
+// Coverage the last fill left in the canvas (fillColor red over white)
+static float canvasCoverage(size_t i) { return (255 - canvas.px[i].g) / 255.0f; }
+
+// Aliased vs analytic-coverage fill vs 4x4 supersampling (an aliased fill of
+// the 4x scaled polygon on a 4x canvas, fill time only) on a WxH canvas, for
+// both fill rules. Errors are coverage differences (0..1) against 16x16
+// point sampling, averaged over pixels the reference puts on an edge.
+void benchAA(int W, int H, unsigned seed) {
+    mt19937 rng(seed);
+    struct Shape { const char *name; vector<Point> pts; };
+    vector<Shape> shapes;
+    shapes.push_back({"star", randomPolygon(POLY_STAR, 64, W, H, rng)});
+    shapes.push_back({"concave", randomPolygon(POLY_CONCAVE, 64, W, H, rng)});
+    shapes.push_back({"concave", randomPolygon(POLY_CONCAVE, 2000, W, H, rng)});
+    {
+        vector<Point> penta;   // {5/2} star: self-intersecting, centre has winding 2
+        for(int i = 0; i < 5; ++i) {
+            double a = M_PI / 2 + 2 * M_PI * (2 * i % 5) / 5;
+            penta.push_back({ W/2 + (int)lround(0.45 * H * cos(a)), H/2 + (int)lround(0.45 * H * sin(a)) });
+        }
+        shapes.push_back({"pentagram", penta});
+    }
+
+    auto best = [](int reps, auto fn) {
+        double b = 1e30;
+        for(int r = 0; r < reps; ++r) b = min(b, fn());
+        return b;
+    };
+    cout << "shape,vertices,rule,aliased_ms,aa_ms,aa_vs_aliased,ssaa4x4_ms,aa_edge_err,aa_max_err,aliased_edge_err\n";
+    for(auto &sh : shapes) {
+        // 4x4 supersampling cost
+        canvas.resize(4 * W, 4 * H, backgroundColor);
+        polygonPts.clear();
+        for(auto &p : sh.pts) polygonPts.push_back({4 * p.x + 2, 4 * p.y + 2});
+        double ssaaMs = best(3, [&]{ clearWindow(); auto t0 = chrono::steady_clock::now(); scanlineFillPolygon(); return msSince(t0); });
+
+        canvas.resize(W, H, backgroundColor);
+        polygonPts = sh.pts;
+        double aliasedMs = best(5, [&]{ clearWindow(); auto t0 = chrono::steady_clock::now(); scanlineFillPolygon(); return msSince(t0); });
+        vector<float> aliased(canvas.px.size());
+        for(size_t i = 0; i < aliased.size(); ++i) aliased[i] = canvasCoverage(i);
+
+        for(FillRule rule : {FILL_NONZERO, FILL_EVEN_ODD}) {
+            double aaMs = best(5, [&]{ clearWindow(); auto t0 = chrono::steady_clock::now(); coverageFillPolygon(rule); return msSince(t0); });
+            vector<float> ref = referenceCoverage(rule, 16);
+            double errSum = 0, errMax = 0, aliasedSum = 0;
+            size_t edgePx = 0;
+            for(size_t i = 0; i < ref.size(); ++i) {
+                double e = fabs(canvasCoverage(i) - ref[i]);
+                errMax = max(errMax, e);
+                if(ref[i] > 0 && ref[i] < 1) {
+                    errSum += e; aliasedSum += fabs(aliased[i] - ref[i]); ++edgePx;
+                }
+            }
+            edgePx = max<size_t>(edgePx, 1);
+            cout << sh.name << ',' << sh.pts.size() << ',' << (rule == FILL_NONZERO ? "nonzero" : "evenodd") << ','
+                 << aliasedMs << ',' << aaMs << ',' << aaMs / aliasedMs << ',' << ssaaMs << ','
+                 << errSum / edgePx << ',' << errMax << ',' << aliasedSum / edgePx << '\n';
+        }
+    }
+}
+
+#ifndef LAB7_HEADLESS
 // ---------- GLUT callbacks ----------
 void display() {
-    // Clear and redraw
-    // Note: when we fill we have already drawn pixels into frame buffer.
-    // We only redraw outline and vertices on top for clarity.
-    glClear(GL_COLOR_BUFFER_BIT);
-    // Redraw any existing filled pixels remain; OpenGL framebuffer keeps them
-    // So we only redraw polygon outline for clarity:
-    if(polygonPts.size() > 0) {
+    // The canvas holds the background, the finished outline and any fills;
+    // blit it in one call and draw the in-progress edges and vertices on top.
+    glRasterPos2i(0, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glDrawPixels(canvas.w, canvas.h, GL_RGB, GL_UNSIGNED_BYTE, canvas.px.data());
+    if(!polygonFinished && polygonPts.size() >= 2) {
         glColor3ub(polygonColor.r, polygonColor.g, polygonColor.b);
-        if(polygonFinished && polygonPts.size() >= 3) {
-            glBegin(GL_LINE_LOOP);
-            for(auto &p: polygonPts) glVertex2i(p.x, p.y);
-            glEnd();
-        } else if(!polygonFinished && polygonPts.size() >= 2) {
-            glBegin(GL_LINE_STRIP);
-            for(auto &p: polygonPts) glVertex2i(p.x, p.y);
-            glEnd();
-        }
+        glBegin(GL_LINE_STRIP);
+        for(auto &p: polygonPts) glVertex2i(p.x, p.y);
+        glEnd();
     }
     // draw vertices
     glPointSize(5.0f);
@@ -244,7 +1483,8 @@ void reshape(int w, int h) {
     gluOrtho2D(0, winWidth-1, 0, winHeight-1);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    clearWindow();
+    canvas.resize(w, h, backgroundColor);
+    if(polygonFinished) drawOutlineToCanvas();
     display();
 }
 
@@ -257,30 +1497,34 @@ void mouse(int button, int state, int x, int y) {
     if(!polygonFinished) {
         if(button == GLUT_LEFT_BUTTON) {
             polygonPts.push_back({cx, cy});
-            // Draw vertex immediately
-            glColor3ub(0,0,255);
-            glBegin(GL_POINTS);
-              glVertex2i(cx, cy);
-            glEnd();
-            glFlush();
+            glutPostRedisplay();
         }
         return;
     }
 
     // If polygon finished, and waiting for seed for flood/boundary, use this click as seed
+    auto t0 = chrono::steady_clock::now();
+    Mode ran = currentMode;
     if(currentMode == WAIT_SEED_FLOOD4) {
         cout << "Performing Flood Fill (4-connected) at seed (" << cx << ", " << cy << ")\n";
-        floodFillIterative(cx, cy, fillColor, false);
+        if(spanFills) floodFillSpan(cx, cy, fillColor, false);
+        else floodFillIterative(cx, cy, fillColor, false);
         currentMode = IDLE;
     } else if(currentMode == WAIT_SEED_FLOOD8) {
         cout << "Performing Flood Fill (8-connected) at seed (" << cx << ", " << cy << ")\n";
-        floodFillIterative(cx, cy, fillColor, true);
+        if(spanFills) floodFillSpan(cx, cy, fillColor, true);
+        else floodFillIterative(cx, cy, fillColor, true);
         currentMode = IDLE;
     } else if(currentMode == WAIT_SEED_BOUNDARY) {
         cout << "Performing Boundary Fill at seed (" << cx << ", " << cy << ")\n";
-        boundaryFillIterative(cx, cy, fillColor, polygonColor);
+        if(spanFills) boundaryFillSpan(cx, cy, fillColor, polygonColor);
+        else boundaryFillIterative(cx, cy, fillColor, polygonColor);
         currentMode = IDLE;
     }
+    if(ran != IDLE) {
+        cout << "Fill took " << msSince(t0) << " ms\n";
+        glutPostRedisplay();
+    }
 }
 
 // Keyboard controls
@@ -290,17 +1534,14 @@ void keyboard(unsigned char key, int x, int y) {
         case 'V':
             if(polygonPts.size() >= 3) {
                 polygonFinished = true;
-                // draw outline
-                glColor3ub(polygonColor.r, polygonColor.g, polygonColor.b);
-                glBegin(GL_LINE_LOOP);
-                  for(auto &p: polygonPts) glVertex2i(p.x, p.y);
-                glEnd();
-                glFlush();
+                drawOutlineToCanvas();
                 cout << "Polygon finished. Press:\n"
                      << "'s' => Scanline fill\n"
+                     << "'a' / 'o' => Anti-aliased fill, nonzero / even-odd rule\n"
                      << "'f' => Flood fill (4-connected), then click seed inside polygon\n"
                      << "'g' => Flood fill (8-connected), then click seed\n"
                      << "'b' => Boundary fill, then click seed\n"
+                     << "'p' => Toggle span / per-pixel flood and boundary fill\n"
                      << "'r' => Reset polygon\n"
                      << "'c' => Clear window (keeps polygon outline)\n";
             } else {
@@ -314,7 +1555,24 @@ void keyboard(unsigned char key, int x, int y) {
                 cout << "Finish polygon first (press 'v').\n";
             } else {
                 cout << "Running Scanline Fill...\n";
-                scanlineFillPolygon();
+                auto t0 = chrono::steady_clock::now();
+                scanlineFillPolygon(fillThreads);
+                cout << "Fill took " << msSince(t0) << " ms\n";
+            }
+            break;
+
+        case 'a': // anti-aliased coverage fill, nonzero / even-odd rule
+        case 'A':
+        case 'o':
+        case 'O':
+            if(!polygonFinished) {
+                cout << "Finish polygon first (press 'v').\n";
+            } else {
+                FillRule rule = (key == 'a' || key == 'A') ? FILL_NONZERO : FILL_EVEN_ODD;
+                cout << "Running Anti-aliased Fill (" << (rule == FILL_NONZERO ? "nonzero" : "even-odd") << " rule)...\n";
+                auto t0 = chrono::steady_clock::now();
+                coverageFillPolygon(rule, fillThreads);
+                cout << "Fill took " << msSince(t0) << " ms\n";
             }
             break;
 
@@ -357,25 +1615,17 @@ void keyboard(unsigned char key, int x, int y) {
             cout << "Polygon reset. Click to add new vertices.\n";
             break;
 
+        case 'p': // span vs per-pixel seed fills
+        case 'P':
+            spanFills = !spanFills;
+            cout << (spanFills ? "Span" : "Per-pixel") << " flood/boundary fill selected.\n";
+            break;
+
         case 'c': // clear window but keep polygon outline
         case 'C':
-            // clear framebuffer
+            // clear framebuffer, then redraw polygon outline (if finished)
             clearWindow();
-            // redraw polygon outline (if finished)
-            if(polygonFinished) {
-                glColor3ub(polygonColor.r, polygonColor.g, polygonColor.b);
-                glBegin(GL_LINE_LOOP);
-                  for(auto &p: polygonPts) glVertex2i(p.x, p.y);
-                glEnd();
-                // redraw vertices
-                glPointSize(5.0f);
-                glBegin(GL_POINTS);
-                glColor3ub(0,0,255);
-                for(auto &p: polygonPts) glVertex2i(p.x, p.y);
-                glEnd();
-                glPointSize(1.0f);
-                glFlush();
-            }
+            if(polygonFinished) drawOutlineToCanvas();
             cout << "Window cleared (polygon outline kept if finished).\n";
             break;
 
@@ -387,10 +1637,12 @@ void keyboard(unsigned char key, int x, int y) {
             cout << "Unknown key. Controls:\n"
                  << "'v' finish polygon\n"
                  << "'s' scanline fill\n"
+                 << "'a' / 'o' anti-aliased fill (nonzero / even-odd)\n"
                  << "'f' flood fill 4-connected (then click seed)\n"
                  << "'g' flood fill 8-connected (then click seed)\n"
                  << "'b' boundary fill (then click seed)\n"
                  << "'r' reset polygon\n"
+                 << "'p' toggle span / per-pixel seed fills\n"
                  << "'c' clear window (keep outline)\n"
                  << "Esc to exit\n";
             break;
@@ -401,28 +1653,74 @@ void keyboard(unsigned char key, int x, int y) {
 // ---------- Initialization ----------
 void initGL() {
     glClearColor(backgroundColor.r/255.0f, backgroundColor.g/255.0f, backgroundColor.b/255.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     gluOrtho2D(0, winWidth-1, 0, winHeight-1);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
     glPointSize(1.0f);
-    glFlush();
+    canvas.resize(winWidth, winHeight, backgroundColor);
 }
+#endif // LAB7_HEADLESS
 
 // ---------- Main ----------
 int main(int argc, char** argv) {
+    enum { RUN_GUI, RUN_BENCH_FILL, RUN_BENCH_SCANLINE, RUN_BENCH_POLYGONS, RUN_BENCH_AA, RUN_BENCH_BATCH, RUN_BENCH_TILED } run = RUN_GUI;
+    int benchW = 800, benchH = 600, benchThreads = 0, benchVerts = 64, benchCount = 3;
+    unsigned benchSeed = 1;
+    int tiledW = 16384, tiledH = 16384, tileShift = 8, cacheTiles = 64;
+    const char *tiledFile = "polygon_fill_tiles.bin";
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--bench-fill")) {
+            run = RUN_BENCH_FILL;
+            if(i+2 < argc && isdigit(argv[i+1][0])) { benchW = atoi(argv[i+1]); benchH = atoi(argv[i+2]); i += 2; }
+        } else if(!strcmp(argv[i], "--bench-scanline")) {
+            run = RUN_BENCH_SCANLINE;
+            if(i+1 < argc && isdigit(argv[i+1][0])) benchThreads = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--bench-polygons")) run = RUN_BENCH_POLYGONS;
+        else if(!strcmp(argv[i], "--bench-aa")) run = RUN_BENCH_AA;
+        else if(!strcmp(argv[i], "--bench-batch")) {
+            run = RUN_BENCH_BATCH;
+            if(i+1 < argc && isdigit(argv[i+1][0])) benchThreads = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--bench-tiled")) {
+            run = RUN_BENCH_TILED;
+            if(i+2 < argc && isdigit(argv[i+1][0])) { tiledW = atoi(argv[i+1]); tiledH = atoi(argv[i+2]); i += 2; }
+        }
+        else if(!strcmp(argv[i], "--tile") && i+1 < argc) {
+            int t = atoi(argv[++i]);
+            for(tileShift = 4; tileShift < 12 && (1 << tileShift) < t; ++tileShift) {}
+        }
+        else if(!strcmp(argv[i], "--cache") && i+1 < argc) cacheTiles = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--file") && i+1 < argc) tiledFile = argv[++i];
+        else if(!strcmp(argv[i], "--size") && i+2 < argc) { benchW = atoi(argv[i+1]); benchH = atoi(argv[i+2]); i += 2; }
+        else if(!strcmp(argv[i], "--vertices") && i+1 < argc) benchVerts = max(3, atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--count") && i+1 < argc) benchCount = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--seed") && i+1 < argc) benchSeed = (unsigned)atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--threads") && i+1 < argc) fillThreads = atoi(argv[++i]);
+    }
+    if(run == RUN_BENCH_FILL) { benchFill(benchW, benchH); return 0; }
+    if(run == RUN_BENCH_SCANLINE) { benchScanline(benchThreads); return 0; }
+    if(run == RUN_BENCH_POLYGONS) { benchPolygons(benchVerts, benchW, benchH, benchCount, benchSeed); return 0; }
+    if(run == RUN_BENCH_AA) { benchAA(benchW, benchH, benchSeed); return 0; }
+    if(run == RUN_BENCH_TILED) { benchTiled(tiledW, tiledH, benchVerts, tileShift, cacheTiles, tiledFile, benchSeed); return 0; }
+    if(run == RUN_BENCH_BATCH) { benchBatch(benchThreads, benchW, benchH, benchSeed); return 0; }
+#ifdef LAB7_HEADLESS
+    cerr << "Built with LAB7_HEADLESS: only the --bench-* modes are available.\n";
+    return 1;
+#else
     cout << "Polygon Fill Demo (C++ / OpenGL GLUT)\n";
     cout << "Instructions:\n";
     cout << " - Left-click to add polygon vertices (while polygon not finished).\n";
     cout << " - Press 'v' to finish polygon (requires >=3 vertices).\n";
     cout << " - After finishing polygon:\n";
     cout << "     's' => Scanline Fill (fills immediately)\n";
+    cout << "     'a' / 'o' => Anti-aliased Fill, nonzero / even-odd rule (fills immediately)\n";
     cout << "     'f' => Flood Fill (4-connected) — then click inside polygon to choose seed\n";
     cout << "     'g' => Flood Fill (8-connected) — then click inside polygon to choose seed\n";
     cout << "     'b' => Boundary Fill — then click inside polygon to choose seed\n";
     cout << " - 'r' => Reset and start a new polygon\n";
+    cout << " - 'p' => Toggle span (default) / per-pixel flood and boundary fill\n";
     cout << " - 'c' => Clear window (keeps outline if polygon finished)\n";
     cout << " - Esc => Exit\n";
 
@@ -441,4 +1739,5 @@ int main(int argc, char** argv) {
 
     glutMainLoop();
     return 0;
+#endif
 }
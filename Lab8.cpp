@@ -1,176 +1,3633 @@
 // mini_rt.cpp
-// Minimal CPU ray tracer (C++17). Compile: g++ -O2 -std=c++17 mini_rt.cpp -o mini_rt
+// Minimal CPU ray tracer (C++17). Compile: g++ -O2 -std=c++17 -pthread mini_rt.cpp -o mini_rt
+//      (add -mavx2 for 256-bit sphere kernels, the default x86-64 build uses 128-bit SSE2;
+//       -DMINIRT_FLOAT renders in float instead of double, -DMINIRT_VEC4 pads vectors to 4 lanes)
 // Run: ./mini_rt   -> writes scene.ppm (open with any image viewer that supports PPM)
+//      ./mini_rt --spheres N   -> render N random spheres instead of the demo scene
+//      ./mini_rt --linear      -> disable the BVH and scan every sphere per ray
+//      ./mini_rt --scalar      -> one sphere at a time instead of the SIMD kernels
+//      ./mini_rt --bench-bvh   -> BVH vs linear scan timings as CSV
+//      ./mini_rt --bench-simd  -> scalar vs SIMD vs packet kernel timings as CSV
+//      ./mini_rt --bench-shadow -> closest-hit vs any-hit shadow ray timings as CSV
+//      ./mini_rt --bench-render [--json] [--baseline old.csv] [--threshold PCT]
+//                              -> render benchmark suite; exits 2 if any scene is more
+//                                 than PCT% (default 10) slower than the baseline CSV
+//      ./mini_rt --threads N [--tile S] [--tile-times]
+//                              -> tiled render on N threads (0 = all cores),
+//                                 optionally printing per-tile timings
+//      ./mini_rt --wavefront   -> breadth-first evaluation, one ray buffer per bounce
+//      ./mini_rt --scene F     -> render a binary scene file (mmapped, used in place)
+//                                 or a text scene (spheres, planes, triangles, meshes)
+//      ./mini_rt --convert in.txt out.bin  -> text scene to binary scene (+BVH)
+//      ./mini_rt [--spheres N] --save-scene F | --save-text F  -> write the scene and exit
+//      ./mini_rt --max-depth D -> reflection bounce limit (default 3)
+//      ./mini_rt --compare-ppm a.ppm b.ppm -> image difference statistics
+//      ./mini_rt --tonemap clamp|reinhard|aces -> HDR to 8-bit operator (default clamp)
+//      ./mini_rt --pfm F       -> also write the linear HDR buffer as PFM
+//      ./mini_rt --bench-tonemap -> pow() vs lookup-table output stage timings as CSV
+//      ./mini_rt --ground-plane -> demo scene with a plane instead of the huge ground sphere
+//      ./mini_rt --obj F       -> add a Wavefront OBJ mesh to the scene (repeatable)
+//      ./mini_rt --lights N [--light-samples S]
+//                              -> N random point lights instead of the key light, S
+//                                 shadow rays per hit (default 1, max 64)
+//      ./mini_rt --bench-lights -> shading cost vs light count as CSV
+//      ./mini_rt --aa MAX [--aa-threshold T]
+//                              -> adaptive supersampling: up to MAX samples for pixels whose
+//                                 neighbourhood contrast exceeds T (default 0.1)
+//      ./mini_rt --bench-aa [--threads N] -> adaptive vs uniform supersampling as CSV
+//      ./mini_rt --denoise     -> edge-aware a-trous filter guided by normal/depth/albedo
+//                                 buffers, for low-sample previews
+//      ./mini_rt --bench-denoise [--threads N] -> denoised 1-16 spp vs a 64 spp render as CSV
+//      ./mini_rt --workers N [--worker-faults]
+//                              -> coordinator + N forked worker processes rendering tiles
+//                                 over local sockets; lost or slow tiles are reassigned
+//                                 (--worker-faults crashes worker 0 and slows worker 1)
+//      ./mini_rt --stats [--stats-json F] -> ray counts after the render (printed, or as JSON);
+//                                 -DMINIRT_STATS adds per-ray traversal/test counts, hits,
+//                                 a reflection depth histogram and shadow occlusion
+//      ./mini_rt --animate SCRIPT [--frame-prefix P] [--animate-compare]
+//                              -> keyframed camera/sphere animation to P0000.ppm, P0001.ppm..
+//                                 (default P = frame_), refitting the BVH and reusing unchanged
+//                                 pixels; --animate-compare also times a naive re-render
+//      ./mini_rt --checkpoint F [--checkpoint-every SEC] | --resume F
+//                              -> tiled render that appends finished tiles to F every SEC
+//                                 seconds (default 5) from a background thread; --resume
+//                                 loads the tiles already in F and renders the rest
 
+#include <cassert>
 #include <cmath>
 #include <limits>
 #include <fstream>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <new>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <array>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Scalar type of the renderer: double by default, float with -DMINIRT_FLOAT
+// (twice the SIMD lanes, less precision). -DMINIRT_VEC4 pads every vector to
+// four aligned components so each one fits, and is operated on, as a single
+// SIMD register.
+#ifdef MINIRT_FLOAT
+typedef float Real;
+#else
+typedef double Real;
+#endif
+#ifdef MINIRT_VEC4
+#define VEC_W(e) , e
+const bool VEC4_LAYOUT = true;
+#else
+#define VEC_W(e)
+const bool VEC4_LAYOUT = false;
+#endif
 
 // small math helpers
-struct Vec {
-    double x,y,z;
-    Vec() : x(0),y(0),z(0) {}
-    Vec(double x_, double y_, double z_) : x(x_),y(y_),z(z_) {}
-    Vec operator+(const Vec& b) const { return Vec(x+b.x,y+b.y,z+b.z); }
-    Vec operator-(const Vec& b) const { return Vec(x-b.x,y-b.y,z-b.z); }
-    Vec operator*(double s) const { return Vec(x*s,y*s,z*s); }
-    Vec operator*(const Vec& b) const { return Vec(x*b.x,y*b.y,z*b.z); } // componentwise
-    Vec operator/(double s) const { return Vec(x/s,y/s,z/s); }
-};
-inline double dot(const Vec& a, const Vec& b){ return a.x*b.x + a.y*b.y + a.z*b.z; }
-inline Vec normalize(const Vec& v){ double n = std::sqrt(dot(v,v)); return v / (n>0? n:1); }
-inline Vec reflect(const Vec& I, const Vec& N){ return I - N*(2*dot(I,N)); }
-const double EPS = 1e-6;
-const double INF = 1e20;
+template <class T>
+struct alignas(VEC4_LAYOUT ? 4*sizeof(T) : alignof(T)) Vec3 {
+    T x,y,z;
+#ifdef MINIRT_VEC4
+    T w = 0; // padding lane, always 0
+    Vec3(T x_, T y_, T z_, T w_) : x(x_),y(y_),z(z_),w(w_) {}
+#endif
+    Vec3() : x(0),y(0),z(0) {}
+    Vec3(T x_, T y_, T z_) : x(x_),y(y_),z(z_) {}
+    Vec3 operator+(const Vec3& b) const { return Vec3(x+b.x,y+b.y,z+b.z VEC_W(w+b.w)); }
+    Vec3 operator-(const Vec3& b) const { return Vec3(x-b.x,y-b.y,z-b.z VEC_W(w-b.w)); }
+    Vec3 operator*(T s) const { return Vec3(x*s,y*s,z*s VEC_W(w*s)); }
+    Vec3 operator*(const Vec3& b) const { return Vec3(x*b.x,y*b.y,z*b.z VEC_W(w*b.w)); } // componentwise
+    Vec3 operator/(T s) const { return Vec3(x/s,y/s,z/s VEC_W(w/s)); }
+    Vec3& operator+=(const Vec3& b) { *this = *this + b; return *this; }
+    Vec3& operator*=(T s) { *this = *this * s; return *this; }
+};
+template <class T> inline T dot(const Vec3<T>& a, const Vec3<T>& b){ return a.x*b.x + a.y*b.y + a.z*b.z; }
+template <class T> inline Vec3<T> normalize(const Vec3<T>& v){ T n = std::sqrt(dot(v,v)); return v / (n>0? n:1); }
+template <class T> inline Vec3<T> reflect(const Vec3<T>& I, const Vec3<T>& N){ return I - N*(2*dot(I,N)); }
+template <class T> inline Vec3<T> cross(const Vec3<T>& a, const Vec3<T>& b){
+    return Vec3<T>(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+}
+typedef Vec3<Real> Vec;
+const Real EPS = 1e-6;
+const Real INF = 1e20;
+// offset for secondary ray origins; float hits on the large ground sphere are
+// only good to ~1e-3, so the float build needs a wider margin
+const Real BIAS = sizeof(Real) < sizeof(double) ? 2e-3 : 1e-4;
 
 // ray
-struct Ray { Vec o, d; Ray(const Vec&o_, const Vec&d_):o(o_),d(d_){} };
+template <class T>
+struct RayT { Vec3<T> o, d; RayT() {} RayT(const Vec3<T>&o_, const Vec3<T>&d_):o(o_),d(d_){} };
+typedef RayT<Real> Ray;
 
 // material
-struct Material {
-    Vec color;      // base color
-    double reflect; // 0..1 reflection strength
-    Material(const Vec&c=Vec(1,1,1), double r=0) : color(c), reflect(r) {}
+template <class T>
+struct MaterialT {
+    Vec3<T> color;  // base color
+    T reflect;      // 0..1 reflection strength
+    MaterialT(const Vec3<T>&c=Vec3<T>(1,1,1), T r=0) : color(c), reflect(r) {}
 };
+typedef MaterialT<Real> Material;
+
+// sphere with centre c and radius r; returns t > 0 or INF
+template <class T>
+inline T intersect_sphere(const Vec3<T>& c, T r, const RayT<T>& ray) {
+    Vec3<T> oc = ray.o - c;
+    T a = dot(ray.d, ray.d);
+    T b = 2*dot(oc, ray.d);
+    T cterm = dot(oc, oc) - r*r;
+    T disc = b*b - 4*a*cterm;
+    if (disc < 0) return INF;
+    T sq = std::sqrt(disc);
+    T t1 = (-b - sq) / (2*a);
+    T t2 = (-b + sq) / (2*a);
+    if (t1 > EPS) return t1;
+    if (t2 > EPS) return t2;
+    return INF;
+}
 
 // sphere
-struct Sphere {
-    Vec c; double r;
-    Material m;
-    Sphere(const Vec&c_, double r_, const Material&m_) : c(c_), r(r_), m(m_) {}
+template <class T>
+struct SphereT {
+    Vec3<T> c; T r;
+    MaterialT<T> m;
+    SphereT(const Vec3<T>&c_, T r_, const MaterialT<T>&m_) : c(c_), r(r_), m(m_) {}
     // returns t > 0 or INF
-    double intersect(const Ray& ray) const {
-        Vec oc = ray.o - c;
-        double a = dot(ray.d, ray.d);
-        double b = 2*dot(oc, ray.d);
-        double cterm = dot(oc, oc) - r*r;
-        double disc = b*b - 4*a*cterm;
-        if (disc < 0) return INF;
-        double sq = std::sqrt(disc);
-        double t1 = (-b - sq) / (2*a);
-        double t2 = (-b + sq) / (2*a);
-        if (t1 > EPS) return t1;
-        if (t2 > EPS) return t2;
-        return INF;
-    }
-};
-
-// scene global
+    T intersect(const RayT<T>& ray) const { return intersect_sphere(c, r, ray); }
+};
+typedef SphereT<Real> Sphere;
+
+// infinite plane dot(n, p) == d, n unit length; hit from either side
+template <class T>
+struct PlaneT {
+    Vec3<T> n; T d;
+    MaterialT<T> m;
+    PlaneT(const Vec3<T>&n_, T d_, const MaterialT<T>&m_) : n(normalize(n_)), d(d_), m(m_) {}
+    T intersect(const RayT<T>& ray) const {
+        T denom = dot(n, ray.d);
+        if (denom == 0) return INF;
+        T t = (d - dot(n, ray.o)) / denom;
+        return t > EPS ? t : INF;
+    }
+};
+typedef PlaneT<Real> Plane;
+
+// Moller-Trumbore against corner a and edges e1 = b-a, e2 = c-a; two-sided,
+// returns t > 0 or INF
+template <class T>
+inline T intersect_triangle(const Vec3<T>& a, const Vec3<T>& e1, const Vec3<T>& e2, const RayT<T>& ray) {
+    Vec3<T> p = cross(ray.d, e2);
+    T det = dot(e1, p);
+    if (det == 0) return INF; // ray parallel to the triangle
+    T inv = 1 / det;
+    Vec3<T> tv = ray.o - a;
+    T u = dot(tv, p) * inv;
+    if (!(u >= 0)) return INF;
+    Vec3<T> q = cross(tv, e1);
+    T v = dot(ray.d, q) * inv;
+    T t = dot(e2, q) * inv;
+    if (!(v >= 0 && 1 >= u + v && t > EPS)) return INF;
+    return t;
+}
+
+template <class T>
+struct TriangleT {
+    Vec3<T> a, b, c;
+    MaterialT<T> m;
+    TriangleT(const Vec3<T>&a_, const Vec3<T>&b_, const Vec3<T>&c_, const MaterialT<T>&m_) : a(a_), b(b_), c(c_), m(m_) {}
+    T intersect(const RayT<T>& ray) const { return intersect_triangle(a, b - a, c - a, ray); }
+};
+typedef TriangleT<Real> Triangle;
+
+// indexed triangle mesh: three vertex indices per triangle, one material
+template <class T>
+struct MeshT {
+    std::vector<Vec3<T>> verts;
+    std::vector<int> index;
+    MaterialT<T> m;
+    int triangles() const { return (int)index.size() / 3; }
+    Vec3<T> corner(int tri, int k) const { return verts[index[3*tri + k]]; }
+};
+typedef MeshT<Real> Mesh;
+
+// ---------- SIMD lanes ----------
+// VR holds SIMD_W Reals, VM a per-lane mask. AVX/AVX2 builds (-mavx2) get
+// 256-bit registers, plain x86-64 gets 128-bit SSE2 ones, anything else falls
+// back to 1 scalar lane, so the kernels below are written once against this
+// small interface. LANE(op) picks the _pd or _ps form of an intrinsic and
+// REG(bits) the matching register type.
+#ifdef MINIRT_FLOAT
+#define LANE(op) op##_ps
+#define REG(bits) __m##bits
+#else
+#define LANE(op) op##_pd
+#define REG(bits) __m##bits##d
+#endif
+#if defined(__AVX__)
+struct VR { REG(256) v; VR() {} VR(REG(256) x) : v(x) {} explicit VR(Real s) : v(LANE(_mm256_set1)(s)) {} };
+typedef VR VM;
+const int SIMD_W = 32 / sizeof(Real);
+inline VR vload(const Real* p){ return LANE(_mm256_load)(p); }
+inline VR vloadu(const Real* p){ return LANE(_mm256_loadu)(p); }
+inline void vstore(Real* p, VR a){ LANE(_mm256_storeu)(p, a.v); }
+inline VR operator+(VR a, VR b){ return LANE(_mm256_add)(a.v, b.v); }
+inline VR operator-(VR a, VR b){ return LANE(_mm256_sub)(a.v, b.v); }
+inline VR operator*(VR a, VR b){ return LANE(_mm256_mul)(a.v, b.v); }
+inline VR operator/(VR a, VR b){ return LANE(_mm256_div)(a.v, b.v); }
+inline VR vsqrt(VR a){ return LANE(_mm256_sqrt)(a.v); }
+inline VR vmin(VR a, VR b){ return LANE(_mm256_min)(a.v, b.v); }
+inline VR vmax(VR a, VR b){ return LANE(_mm256_max)(a.v, b.v); }
+inline VM vlt(VR a, VR b){ return LANE(_mm256_cmp)(a.v, b.v, _CMP_LT_OQ); }
+inline VM vge(VR a, VR b){ return LANE(_mm256_cmp)(a.v, b.v, _CMP_GE_OQ); }
+inline VM vand(VM a, VM b){ return LANE(_mm256_and)(a.v, b.v); }
+inline VR vselect(VM m, VR a, VR b){ return LANE(_mm256_blendv)(b.v, a.v, m.v); }
+inline bool vany(VM m){ return LANE(_mm256_movemask)(m.v) != 0; }
+#elif defined(__SSE2__)
+struct VR { REG(128) v; VR() {} VR(REG(128) x) : v(x) {} explicit VR(Real s) : v(LANE(_mm_set1)(s)) {} };
+typedef VR VM;
+const int SIMD_W = 16 / sizeof(Real);
+inline VR vload(const Real* p){ return LANE(_mm_load)(p); }
+inline VR vloadu(const Real* p){ return LANE(_mm_loadu)(p); }
+inline void vstore(Real* p, VR a){ LANE(_mm_storeu)(p, a.v); }
+inline VR operator+(VR a, VR b){ return LANE(_mm_add)(a.v, b.v); }
+inline VR operator-(VR a, VR b){ return LANE(_mm_sub)(a.v, b.v); }
+inline VR operator*(VR a, VR b){ return LANE(_mm_mul)(a.v, b.v); }
+inline VR operator/(VR a, VR b){ return LANE(_mm_div)(a.v, b.v); }
+inline VR vsqrt(VR a){ return LANE(_mm_sqrt)(a.v); }
+inline VR vmin(VR a, VR b){ return LANE(_mm_min)(a.v, b.v); }
+inline VR vmax(VR a, VR b){ return LANE(_mm_max)(a.v, b.v); }
+inline VM vlt(VR a, VR b){ return LANE(_mm_cmplt)(a.v, b.v); }
+inline VM vge(VR a, VR b){ return LANE(_mm_cmpge)(a.v, b.v); }
+inline VM vand(VM a, VM b){ return LANE(_mm_and)(a.v, b.v); }
+inline VR vselect(VM m, VR a, VR b){ return LANE(_mm_or)(LANE(_mm_and)(m.v, a.v), LANE(_mm_andnot)(m.v, b.v)); }
+inline bool vany(VM m){ return LANE(_mm_movemask)(m.v) != 0; }
+#else
+struct VR { Real v; VR() {} explicit VR(Real s) : v(s) {} };
+struct VM { bool v; };
+const int SIMD_W = 1;
+inline VR vload(const Real* p){ return VR(*p); }
+inline VR vloadu(const Real* p){ return VR(*p); }
+inline void vstore(Real* p, VR a){ *p = a.v; }
+inline VR operator+(VR a, VR b){ return VR(a.v + b.v); }
+inline VR operator-(VR a, VR b){ return VR(a.v - b.v); }
+inline VR operator*(VR a, VR b){ return VR(a.v * b.v); }
+inline VR operator/(VR a, VR b){ return VR(a.v / b.v); }
+inline VR vsqrt(VR a){ return VR(std::sqrt(a.v)); }
+inline VR vmin(VR a, VR b){ return VR(std::min(a.v, b.v)); }
+inline VR vmax(VR a, VR b){ return VR(std::max(a.v, b.v)); }
+inline VM vlt(VR a, VR b){ return VM{a.v < b.v}; }
+inline VM vge(VR a, VR b){ return VM{a.v >= b.v}; }
+inline VM vand(VM a, VM b){ return VM{a.v && b.v}; }
+inline VR vselect(VM m, VR a, VR b){ return m.v ? a : b; }
+inline bool vany(VM m){ return m.v; }
+#endif
+// lane indices 0, 1, ..., SIMD_W-1
+inline VR vlanes(){
+    Real l[SIMD_W];
+    for (int i=0;i<SIMD_W;++i) l[i] = (Real)i;
+    return vloadu(l);
+}
+
+// same arithmetic as Sphere::intersect, W spheres or W rays at a time
+inline VR sphere_hit(VR ox, VR oy, VR oz, VR dx, VR dy, VR dz,
+                     VR cx, VR cy, VR cz, VR r) {
+    const VR zero(0), two(2), four(4), eps(EPS), inf(INF);
+    VR ocx = ox - cx, ocy = oy - cy, ocz = oz - cz;
+    VR a = dx*dx + dy*dy + dz*dz;
+    VR b = two*(ocx*dx + ocy*dy + ocz*dz);
+    VR cterm = (ocx*ocx + ocy*ocy + ocz*ocz) - r*r;
+    VR disc = b*b - four*a*cterm;
+    VM hit = vge(disc, zero);
+    if (!vany(hit)) return inf; // most tests miss: skip the sqrt and divides
+    VR sq = vsqrt(vmax(disc, zero));
+    VR t1 = (zero - b - sq) / (two*a);
+    VR t2 = (zero - b + sq) / (two*a);
+    VR t = vselect(vlt(eps, t1), t1, vselect(vlt(eps, t2), t2, inf));
+    return vselect(hit, t, inf);
+}
+
+// same arithmetic as intersect_triangle, W triangles or W rays at a time
+inline VR triangle_hit(VR ox, VR oy, VR oz, VR dx, VR dy, VR dz,
+                       VR ax, VR ay, VR az, VR e1x, VR e1y, VR e1z, VR e2x, VR e2y, VR e2z) {
+    const VR zero(0), one(1), eps(EPS), inf(INF);
+    VR px = dy*e2z - dz*e2y, py = dz*e2x - dx*e2z, pz = dx*e2y - dy*e2x;
+    VR det = e1x*px + e1y*py + e1z*pz;
+    VR inv = one / det; // det == 0 gives inf/NaN below, which fails every test
+    VR tx = ox - ax, ty = oy - ay, tz = oz - az;
+    VR u = (tx*px + ty*py + tz*pz) * inv;
+    VM hit = vge(u, zero);
+    if (!vany(hit)) return inf;
+    VR qx = ty*e1z - tz*e1y, qy = tz*e1x - tx*e1z, qz = tx*e1y - ty*e1x;
+    VR v = (dx*qx + dy*qy + dz*qz) * inv;
+    VR t = (e2x*qx + e2y*qy + e2z*qz) * inv;
+    hit = vand(vand(hit, vge(v, zero)), vand(vge(one, u + v), vlt(eps, t)));
+    return vselect(hit, t, inf);
+}
+
+// 32-byte aligned storage for the SoA arrays
+template <class T>
+struct AlignedAlloc {
+    typedef T value_type;
+    AlignedAlloc() {}
+    template <class U> AlignedAlloc(const AlignedAlloc<U>&) {}
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(32))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(32)); }
+    template <class U> bool operator==(const AlignedAlloc<U>&) const { return true; }
+    template <class U> bool operator!=(const AlignedAlloc<U>&) const { return false; }
+};
+typedef std::vector<Real, AlignedAlloc<Real>> AlignedReals;
+
+// read-only array that either owns its storage or views memory owned
+// elsewhere (an mmapped scene file), so loaded scenes can be used in place
+template <class T, class Alloc = std::allocator<T>>
+struct Buffer {
+    std::vector<T, Alloc> own;
+    const T* ptr = nullptr;
+    size_t n = 0;
+    Buffer() {}
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+    void adopt(std::vector<T, Alloc>&& v) { own = std::move(v); ptr = own.data(); n = own.size(); }
+    void view(const T* p, size_t count) { own.clear(); own.shrink_to_fit(); ptr = p; n = count; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+    const T* data() const { return ptr; }
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+};
+
+// structure-of-arrays copy of the sphere geometry. Slots are padded to a
+// multiple of SIMD_W (plus one extra group so unaligned loads near the end
+// stay in bounds); the BVH maps slots back to indices in `spheres`.
+struct SphereSoA {
+    Buffer<Real, AlignedAlloc<Real>> cx, cy, cz, r;
+    int count = 0;
+
+    static size_t padded_size(size_t count) { return (count + SIMD_W - 1) / SIMD_W * SIMD_W + SIMD_W; }
+
+    void build(const std::vector<Sphere>& s, const std::vector<int>& order) {
+        count = (int)order.size();
+        size_t padded = padded_size(count);
+        AlignedReals x(padded, 0), y(padded, 0), z(padded, 0), rad(padded, 0);
+        for (int k=0;k<count;++k){
+            const Sphere &sp = s[order[k]];
+            x[k] = sp.c.x; y[k] = sp.c.y; z[k] = sp.c.z; rad[k] = sp.r;
+        }
+        cx.adopt(std::move(x)); cy.adopt(std::move(y)); cz.adopt(std::move(z)); r.adopt(std::move(rad));
+    }
+
+    // one slot, scalar
+    Real hit(int k, const Ray& ray) const { return intersect_sphere(Vec(cx[k], cy[k], cz[k]), r[k], ray); }
+
+    // closest hit of one ray against slots [first, first+n); only improves t/slot
+    void intersect(const Ray& ray, int first, int n, Real &t, int &slot) const {
+        VR ox(ray.o.x), oy(ray.o.y), oz(ray.o.z), dx(ray.d.x), dy(ray.d.y), dz(ray.d.z);
+        VR best(INF), bestSlot(-1.0);
+        for (int k=first; k<first+n; k+=SIMD_W){
+            VR th = sphere_hit(ox, oy, oz, dx, dy, dz,
+                               vloadu(&cx[k]), vloadu(&cy[k]), vloadu(&cz[k]), vloadu(&r[k]));
+            VR lane = vlanes() + VR((Real)k);
+            VM take = vand(vlt(th, best), vlt(lane, VR((Real)(first+n))));
+            best = vselect(take, th, best);
+            bestSlot = vselect(take, lane, bestSlot);
+        }
+        // reduce lanes; equal distances go to the lower slot, as a scalar scan would
+        Real bt[SIMD_W], bs[SIMD_W];
+        vstore(bt, best); vstore(bs, bestSlot);
+        int l0 = 0;
+        for (int l=1;l<SIMD_W;++l)
+            if (bt[l] < bt[l0] || (bt[l] == bt[l0] && bs[l] < bs[l0])) l0 = l;
+        if (bt[l0] < t) { t = bt[l0]; slot = (int)bs[l0]; }
+    }
+
+    // first slot in [first, first+n) hit closer than tmax, or -1
+    int any_hit(const Ray& ray, int first, int n, Real tmax) const {
+        VR ox(ray.o.x), oy(ray.o.y), oz(ray.o.z), dx(ray.d.x), dy(ray.d.y), dz(ray.d.z);
+        for (int k=first; k<first+n; k+=SIMD_W){
+            VR th = sphere_hit(ox, oy, oz, dx, dy, dz,
+                               vloadu(&cx[k]), vloadu(&cy[k]), vloadu(&cz[k]), vloadu(&r[k]));
+            VM hit = vand(vlt(th, VR(tmax)), vlt(vlanes() + VR((Real)k), VR((Real)(first+n))));
+            if (!vany(hit)) continue;
+            Real tl[SIMD_W];
+            vstore(tl, th);
+            for (int l=0;l<SIMD_W;++l) if (k+l < first+n && tl[l] < tmax) return k+l;
+        }
+        return -1;
+    }
+
+    // closest hits of a packet of SIMD_W rays (lane l = ray l) against slots [first, first+n)
+    void intersect_packet(VR ox, VR oy, VR oz, VR dx, VR dy, VR dz, int first, int n,
+                          VR &t, VR &slot) const {
+        for (int k=first; k<first+n; ++k){
+            VR th = sphere_hit(ox, oy, oz, dx, dy, dz, VR(cx[k]), VR(cy[k]), VR(cz[k]), VR(r[k]));
+            VM take = vlt(th, t);
+            t = vselect(take, th, t);
+            slot = vselect(take, VR((Real)k), slot);
+        }
+    }
+};
+
+// a triangle of the scene, from the `triangles` list or from a mesh, with the
+// hit id it shades as; input to the triangle BVH
+struct TriangleRec { Vec a, b, c; int id; };
+
+// structure-of-arrays triangles (corner a and both edges, ready for
+// Moller-Trumbore), padded like SphereSoA; padding slots are degenerate
+struct TriangleSoA {
+    Buffer<Real, AlignedAlloc<Real>> ax, ay, az, e1x, e1y, e1z, e2x, e2y, e2z;
+    int count = 0;
+
+    void build(const std::vector<TriangleRec>& s, const std::vector<int>& order) {
+        count = (int)order.size();
+        size_t padded = SphereSoA::padded_size(count);
+        AlignedReals v[9];
+        for (AlignedReals &a : v) a.assign(padded, 0);
+        for (int k=0;k<count;++k){
+            const TriangleRec &tr = s[order[k]];
+            Vec e1 = tr.b - tr.a, e2 = tr.c - tr.a;
+            v[0][k] = tr.a.x; v[1][k] = tr.a.y; v[2][k] = tr.a.z;
+            v[3][k] = e1.x;   v[4][k] = e1.y;   v[5][k] = e1.z;
+            v[6][k] = e2.x;   v[7][k] = e2.y;   v[8][k] = e2.z;
+        }
+        ax.adopt(std::move(v[0])); ay.adopt(std::move(v[1])); az.adopt(std::move(v[2]));
+        e1x.adopt(std::move(v[3])); e1y.adopt(std::move(v[4])); e1z.adopt(std::move(v[5]));
+        e2x.adopt(std::move(v[6])); e2y.adopt(std::move(v[7])); e2z.adopt(std::move(v[8]));
+    }
+
+    Real hit(int k, const Ray& ray) const {
+        return intersect_triangle(Vec(ax[k], ay[k], az[k]), Vec(e1x[k], e1y[k], e1z[k]), Vec(e2x[k], e2y[k], e2z[k]), ray);
+    }
+    VR hit_lanes(int k, VR ox, VR oy, VR oz, VR dx, VR dy, VR dz) const {
+        return triangle_hit(ox, oy, oz, dx, dy, dz, vloadu(&ax[k]), vloadu(&ay[k]), vloadu(&az[k]),
+                            vloadu(&e1x[k]), vloadu(&e1y[k]), vloadu(&e1z[k]),
+                            vloadu(&e2x[k]), vloadu(&e2y[k]), vloadu(&e2z[k]));
+    }
+
+    // closest hit of one ray against slots [first, first+n); only improves t/slot
+    void intersect(const Ray& ray, int first, int n, Real &t, int &slot) const {
+        VR ox(ray.o.x), oy(ray.o.y), oz(ray.o.z), dx(ray.d.x), dy(ray.d.y), dz(ray.d.z);
+        for (int k=first; k<first+n; k+=SIMD_W){
+            VR th = hit_lanes(k, ox, oy, oz, dx, dy, dz);
+            VM take = vand(vlt(th, VR(t)), vlt(vlanes() + VR((Real)k), VR((Real)(first+n))));
+            if (!vany(take)) continue;
+            Real tl[SIMD_W];
+            vstore(tl, th);
+            for (int l=0;l<SIMD_W && k+l<first+n;++l) if (tl[l] < t) { t = tl[l]; slot = k+l; }
+        }
+    }
+
+    // first slot in [first, first+n) hit closer than tmax, or -1
+    int any_hit(const Ray& ray, int first, int n, Real tmax) const {
+        VR ox(ray.o.x), oy(ray.o.y), oz(ray.o.z), dx(ray.d.x), dy(ray.d.y), dz(ray.d.z);
+        for (int k=first; k<first+n; k+=SIMD_W){
+            VR th = hit_lanes(k, ox, oy, oz, dx, dy, dz);
+            if (!vany(vand(vlt(th, VR(tmax)), vlt(vlanes() + VR((Real)k), VR((Real)(first+n)))))) continue;
+            Real tl[SIMD_W];
+            vstore(tl, th);
+            for (int l=0;l<SIMD_W;++l) if (k+l < first+n && tl[l] < tmax) return k+l;
+        }
+        return -1;
+    }
+};
+
+// scene globals: one homogeneous array per primitive type
 std::vector<Sphere> spheres;
+std::vector<Plane> planes;
+std::vector<Triangle> triangles;
+std::vector<Mesh> meshes;
 
-// find closest hit
-bool scene_intersect(const Ray& ray, double &t, int &id) {
+// ---------- lights ----------
+enum LightKind { LIGHT_POINT, LIGHT_DIRECTIONAL, LIGHT_SPHERE };
+struct Light {
+    LightKind kind;
+    Vec pos;        // point light position / sphere light centre
+    Vec dir;        // directional lights: unit direction the light travels in
+    Real radius;    // sphere lights
+    Vec color;      // intensity (at distance 1 when falloff is on)
+    bool falloff;   // inverse-square falloff, point and sphere lights only
+    static Light point(const Vec& p, const Vec& c, bool falloff) { return {LIGHT_POINT, p, Vec(), 0, c, falloff}; }
+    static Light directional(const Vec& d, const Vec& c) { return {LIGHT_DIRECTIONAL, Vec(), normalize(d), 0, c, false}; }
+    static Light sphere(const Vec& p, Real r, const Vec& c, bool falloff) { return {LIGHT_SPHERE, p, Vec(), r, c, falloff}; }
+};
+std::vector<Light> lights;
+
+// the single key light every built-in scene has always used; no falloff
+inline Light default_light() { return Light::point(Vec(5, 10, -2), Vec(1.0, 1.0, 1.0), false); }
+
+// Power-weighted light selection in O(1) per sample (Vose's alias method):
+// bucket i keeps light i with probability prob[i], otherwise it gives alias[i].
+struct LightTable {
+    std::vector<Real> prob, pdf; // pdf[i]: chance that light i is picked
+    std::vector<int> alias;
+
+    void build(const std::vector<Light>& ls) {
+        int n = (int)ls.size();
+        prob.assign(n, 1); alias.resize(n); pdf.resize(n);
+        double total = 0;
+        std::vector<double> w(n);
+        for (int i=0;i<n;++i){
+            const Vec &c = ls[i].color;
+            w[i] = std::max(0.0, 0.2126*c.x + 0.7152*c.y + 0.0722*c.z); // luminance
+            total += w[i];
+        }
+        for (int i=0;i<n;++i) w[i] = total > 0 ? w[i] / total : 1.0 / n;
+        for (int i=0;i<n;++i) pdf[i] = (Real)w[i];
+        std::vector<int> small, large;
+        std::vector<double> scaled(n);
+        for (int i=0;i<n;++i){ scaled[i] = w[i] * n; (scaled[i] < 1 ? small : large).push_back(i); }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back(), l = large.back();
+            small.pop_back();
+            prob[s] = (Real)scaled[s]; alias[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) { large.pop_back(); small.push_back(l); }
+        }
+        for (int i : small) { prob[i] = 1; alias[i] = i; } // rounding leftovers
+        for (int i : large) { prob[i] = 1; alias[i] = i; }
+    }
+    // light for u in [0,1); p gets its selection probability
+    int sample(Real u, Real &p) const {
+        int n = (int)prob.size();
+        Real x = u * n;
+        int i = std::min(n - 1, (int)x);
+        int k = x - i < prob[i] ? i : alias[i];
+        p = pdf[k];
+        return k;
+    }
+};
+LightTable lightTable;
+
+// n point lights with falloff scattered over the random scene's box, sharing
+// a fixed total intensity
+void build_random_lights(int n, unsigned seed = 7) {
+    lights.clear();
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> ux(-45, 45), uy(-35, 35), uz(-125, -15), u01(0.5, 1);
+    for (int i=0;i<n;++i)
+        lights.push_back(Light::point(Vec(ux(rng), uy(rng), uz(rng)),
+                                      Vec(u01(rng), u01(rng), u01(rng)) * (Real)(3000.0 / n), true));
+    lightTable.build(lights);
+}
+bool useSIMD = true;
+
+// scene mapped from a binary scene file (see load_scene_file); while count > 0
+// it stands in for `spheres` and ids index these arrays directly
+struct MappedScene {
+    const void* base = nullptr;
+    size_t bytes = 0;
+    size_t count = 0;
+    const Real *cx = nullptr, *cy = nullptr, *cz = nullptr, *r = nullptr;
+    const uint32_t* matIndex = nullptr;
+    const Material* materials = nullptr;
+    size_t materialCount = 0;
+};
+MappedScene mappedScene;
+
+inline int scene_size() { return mappedScene.count ? (int)mappedScene.count : (int)spheres.size(); }
+inline Vec sphere_center(int id) {
+    if (mappedScene.count) return Vec(mappedScene.cx[id], mappedScene.cy[id], mappedScene.cz[id]);
+    return spheres[id].c;
+}
+inline Real sphere_radius(int id) { return mappedScene.count ? mappedScene.r[id] : spheres[id].r; }
+inline const Material& sphere_material(int id) {
+    if (mappedScene.count) return mappedScene.materials[mappedScene.matIndex[id]];
+    return spheres[id].m;
+}
+
+// Hit ids carry the primitive kind in their top bits. Spheres are kind 0, so a
+// sphere's id is still its index and sphere-only code never decodes ids.
+enum PrimKind { PRIM_SPHERE, PRIM_PLANE, PRIM_TRIANGLE, PRIM_MESH };
+const int PRIM_SHIFT = 28;
+inline int prim_id(PrimKind k, int index) { return (int)k << PRIM_SHIFT | index; }
+inline PrimKind prim_kind(int id) { return PrimKind(id >> PRIM_SHIFT); }
+inline int prim_index(int id) { return id & ((1 << PRIM_SHIFT) - 1); }
+
+// mesh triangles are numbered across all meshes; meshFirst[m] is mesh m's first
+// number (see index_meshes)
+std::vector<int> meshFirst;
+void index_meshes() {
+    meshFirst.clear();
+    int n = 0;
+    for (const Mesh &m : meshes) { meshFirst.push_back(n); n += m.triangles(); }
+}
+inline int mesh_of(int tri) {
+    return int(std::upper_bound(meshFirst.begin(), meshFirst.end(), tri) - meshFirst.begin()) - 1;
+}
+
+// per-hit lookups; these switch on the kind once per shaded hit, never per test
+inline const Material& prim_material(int id) {
+    int i = prim_index(id);
+    switch (prim_kind(id)) {
+    case PRIM_PLANE:    return planes[i].m;
+    case PRIM_TRIANGLE: return triangles[i].m;
+    case PRIM_MESH:     return meshes[mesh_of(i)].m;
+    default:            return sphere_material(id);
+    }
+}
+
+// outward normal for spheres; flat primitives are two-sided, so theirs faces the ray
+inline Vec prim_normal(int id, const Vec& hit, const Ray& ray) {
+    int i = prim_index(id);
+    Vec N;
+    switch (prim_kind(id)) {
+    case PRIM_SPHERE:   return normalize(hit - sphere_center(id));
+    case PRIM_PLANE:    N = planes[i].n; break;
+    case PRIM_TRIANGLE: N = normalize(cross(triangles[i].b - triangles[i].a, triangles[i].c - triangles[i].a)); break;
+    case PRIM_MESH: {
+        int m = mesh_of(i), tri = i - meshFirst[m];
+        Vec a = meshes[m].corner(tri, 0);
+        N = normalize(cross(meshes[m].corner(tri, 1) - a, meshes[m].corner(tri, 2) - a));
+        break;
+    }
+    }
+    return dot(N, ray.d) > 0 ? N * Real(-1) : N;
+}
+
+// distance to one primitive, INF on a miss or an id not in the current scene
+inline Real prim_hit(int id, const Ray& ray) {
+    int i = prim_index(id);
+    switch (prim_kind(id)) {
+    case PRIM_SPHERE:   return i < scene_size() ? intersect_sphere(sphere_center(i), sphere_radius(i), ray) : INF;
+    case PRIM_PLANE:    return i < (int)planes.size() ? planes[i].intersect(ray) : INF;
+    case PRIM_TRIANGLE: return i < (int)triangles.size() ? triangles[i].intersect(ray) : INF;
+    case PRIM_MESH: {
+        int m = mesh_of(i);
+        if (m < 0 || m >= (int)meshes.size() || i - meshFirst[m] >= meshes[m].triangles()) return INF;
+        int tri = i - meshFirst[m];
+        Vec a = meshes[m].corner(tri, 0);
+        return intersect_triangle(a, meshes[m].corner(tri, 1) - a, meshes[m].corner(tri, 2) - a, ray);
+    }
+    }
+    return INF;
+}
+
+// axis-aligned bounding box
+struct AABB {
+    Vec lo, hi;
+    AABB() : lo(INF,INF,INF), hi(-INF,-INF,-INF) {}
+    void grow(const Vec& p) {
+        lo = Vec(std::min(lo.x,p.x), std::min(lo.y,p.y), std::min(lo.z,p.z));
+        hi = Vec(std::max(hi.x,p.x), std::max(hi.y,p.y), std::max(hi.z,p.z));
+    }
+    void grow(const AABB& b) {
+        lo = Vec(std::min(lo.x,b.lo.x), std::min(lo.y,b.lo.y), std::min(lo.z,b.lo.z));
+        hi = Vec(std::max(hi.x,b.hi.x), std::max(hi.y,b.hi.y), std::max(hi.z,b.hi.z));
+    }
+    Real area() const {
+        Vec e = hi - lo;
+        if (e.x < 0) return 0;
+        return 2*(e.x*e.y + e.y*e.z + e.z*e.x);
+    }
+};
+inline AABB sphere_bounds(const Sphere& s){
+    AABB b; b.grow(s.c - Vec(s.r,s.r,s.r)); b.grow(s.c + Vec(s.r,s.r,s.r)); return b;
+}
+// per-type bounds and centroids for the BVH builder
+inline AABB prim_bounds(const Sphere& s){ return sphere_bounds(s); }
+inline Vec prim_centroid(const Sphere& s){ return s.c; }
+inline AABB prim_bounds(const TriangleRec& t){ AABB b; b.grow(t.a); b.grow(t.b); b.grow(t.c); return b; }
+inline Vec prim_centroid(const TriangleRec& t){ return (t.a + t.b + t.c) / 3; }
+
+// slab test; returns entry distance or INF if the box is missed / farther than tmax
+inline Real ray_box(const AABB& b, const Vec& o, const Vec& invD, Real tmax){
+    Real tx1 = (b.lo.x - o.x)*invD.x, tx2 = (b.hi.x - o.x)*invD.x;
+    Real tmin = std::min(tx1,tx2), tmx = std::max(tx1,tx2);
+    Real ty1 = (b.lo.y - o.y)*invD.y, ty2 = (b.hi.y - o.y)*invD.y;
+    tmin = std::max(tmin, std::min(ty1,ty2)); tmx = std::min(tmx, std::max(ty1,ty2));
+    Real tz1 = (b.lo.z - o.z)*invD.z, tz2 = (b.hi.z - o.z)*invD.z;
+    tmin = std::max(tmin, std::min(tz1,tz2)); tmx = std::min(tmx, std::max(tz1,tz2));
+    if (tmx >= tmin && tmx > 0 && tmin < tmax) return tmin;
+    return INF;
+}
+
+// ---------- ray statistics ----------
+// Rays traced, by kind, are always counted. Building with -DMINIRT_STATS adds
+// the counters below the #ifdef: BVH nodes visited, primitive tests, hits and
+// misses, a reflection depth histogram and shadow occlusion. Their updates go
+// through STAT(), which is empty otherwise, so a default build carries no
+// trace of them. Each thread counts into its own copy, which is added to the
+// shared total when the thread exits (or on collect_ray_counts()); hot loops
+// count into locals and add once per query.
+#ifdef MINIRT_STATS
+#define STAT(x) (x)
+#else
+#define STAT(x) ((void)0)
+#endif
+const int STAT_DEPTHS = 8; // depth histogram buckets, the last one also counts deeper rays
+
+struct RayCounts {
+    long long primary = 0, shadow = 0, reflection = 0;
+#ifdef MINIRT_STATS
+    long long nodes = 0;                      // BVH nodes visited
+    long long sphereTests = 0, flatTests = 0; // ray-primitive tests, SIMD lanes counted one by one
+    long long hits = 0, misses = 0;           // closest-hit rays (primary and reflection)
+    long long occluded = 0, cacheHits = 0;    // shadow rays blocked, and blocked by the cached occluder
+    long long depth[STAT_DEPTHS] = {};        // closest-hit rays by reflection depth
+#endif
+    long long total() const { return primary + shadow + reflection; }
+    RayCounts& operator+=(const RayCounts& o) {
+        primary += o.primary; shadow += o.shadow; reflection += o.reflection;
+#ifdef MINIRT_STATS
+        nodes += o.nodes; sphereTests += o.sphereTests; flatTests += o.flatTests;
+        hits += o.hits; misses += o.misses; occluded += o.occluded; cacheHits += o.cacheHits;
+        for (int d = 0; d < STAT_DEPTHS; ++d) depth[d] += o.depth[d];
+#endif
+        return *this;
+    }
+};
+RayCounts rayTotals;
+std::mutex rayTotalsMutex;
+struct ThreadRayCounts : RayCounts {
+    void flush() {
+        std::lock_guard<std::mutex> lk(rayTotalsMutex);
+        rayTotals += *this;
+        static_cast<RayCounts&>(*this) = RayCounts();
+    }
+    ~ThreadRayCounts() { flush(); }
+};
+thread_local ThreadRayCounts rayCounts;
+
+// totals since the last reset; call after worker threads have been joined
+RayCounts collect_ray_counts() {
+    rayCounts.flush();
+    std::lock_guard<std::mutex> lk(rayTotalsMutex);
+    return rayTotals;
+}
+void reset_ray_counts() {
+    rayCounts.flush();
+    std::lock_guard<std::mutex> lk(rayTotalsMutex);
+    rayTotals = RayCounts();
+}
+
+inline double ratio(long long a, long long b) { return b ? (double)a / b : 0.0; }
+
+void print_ray_stats(const RayCounts& rc, double ms) {
+    std::cout << "Rays: " << rc.total() << " (" << rc.primary << " primary, " << rc.reflection << " reflection, "
+              << rc.shadow << " shadow = " << 100 * ratio(rc.shadow, rc.total()) << "%), "
+              << rc.total() / (ms * 1e3) << " Mrays/s\n";
+#ifdef MINIRT_STATS
+    std::cout << "Per ray: " << ratio(rc.nodes, rc.total()) << " BVH nodes, " << ratio(rc.sphereTests, rc.total())
+              << " sphere tests, " << ratio(rc.flatTests, rc.total()) << " plane/triangle tests\n"
+              << "Closest hit: " << rc.hits << " hits, " << rc.misses << " misses; by depth:";
+    for (int d = 0; d < STAT_DEPTHS; ++d) std::cout << " " << rc.depth[d];
+    std::cout << "\nShadow rays: " << 100 * ratio(rc.occluded, rc.shadow) << "% occluded, "
+              << 100 * ratio(rc.cacheHits, rc.shadow) << "% answered by the occluder cache\n";
+#else
+    std::cout << "(build with -DMINIRT_STATS for traversal, hit, depth and occlusion counters)\n";
+#endif
+}
+
+bool write_ray_stats_json(const std::string& path, const RayCounts& rc, double ms) {
+    std::ofstream out(path);
+    out << "{\"ms\": " << ms << ", \"primary\": " << rc.primary << ", \"reflection\": " << rc.reflection
+        << ", \"shadow\": " << rc.shadow << ", \"total\": " << rc.total();
+#ifdef MINIRT_STATS
+    out << ", \"bvh_nodes\": " << rc.nodes << ", \"sphere_tests\": " << rc.sphereTests
+        << ", \"flat_tests\": " << rc.flatTests << ", \"hits\": " << rc.hits << ", \"misses\": " << rc.misses
+        << ", \"shadow_occluded\": " << rc.occluded << ", \"occluder_cache_hits\": " << rc.cacheHits
+        << ", \"depth\": [";
+    for (int d = 0; d < STAT_DEPTHS; ++d) out << (d ? ", " : "") << rc.depth[d];
+    out << "]";
+#endif
+    out << "}\n";
+    if (!out) { std::cerr << path << ": write failed\n"; return false; }
+    return true;
+}
+
+#ifdef MINIRT_STATS
+// counter for the primitive tests of a BVH over this store
+inline long long& test_counter(const SphereSoA&) { return rayCounts.sphereTests; }
+inline long long& test_counter(const TriangleSoA&) { return rayCounts.flatTests; }
+
+// one closest-hit ray at the given reflection depth
+inline void count_closest(int depth, bool hit) {
+    RayCounts &rc = rayCounts;
+    ++(hit ? rc.hits : rc.misses);
+    ++rc.depth[std::min(depth, STAT_DEPTHS - 1)];
+}
+#endif
+
+// bounding volume hierarchy over one primitive type, built with binned SAH.
+// Store holds the leaf geometry (SphereSoA, TriangleSoA) and provides the
+// leaf kernels, so traversal never switches on primitive type.
+// Nodes live in one flat array; the two children of an interior node are
+// stored next to each other so only the first child's index is kept.
+struct BVHNode {
+    AABB box;
+    int first; // interior: index of left child (right = first+1); leaf: offset into prims
+    int count; // 0 for interior nodes, number of primitives for leaves
+};
+
+template <class Store>
+struct BVHT {
+    Buffer<BVHNode> nodes;
+    Buffer<int> prims;      // primitive indices, grouped by leaf
+    Store soa;              // geometry in prims order, so leaves are contiguous slots
+
+    static const int BINS = 16;
+    static const int MAX_LEAF = 4;   // always make a leaf at or below this size
+    static const int FORCE_SPLIT = 16; // always split above this size, whatever SAH says
+    static const int MAX_DEPTH = 64;   // deeper subtrees become a single leaf
+    static const int STACK_SIZE = 128; // traversal stack; holds at most MAX_DEPTH+1 nodes
+    static_assert(MAX_DEPTH + 1 <= STACK_SIZE, "traversal stack too small for MAX_DEPTH");
+
+    bool built() const { return !nodes.empty(); }
+    // primitive index of a leaf slot; an empty prims array means slots are indices
+    int prim(int slot) const { return prims.empty() ? slot : prims[slot]; }
+
+    template <class P>
+    void build(const std::vector<P>& s) {
+        work.clear(); order.resize(s.size());
+        if (s.empty()) { nodes.adopt(std::move(work)); prims.adopt(std::move(order)); return; }
+        bounds.resize(s.size()); centroids.resize(s.size());
+        for (int i=0;i<(int)s.size();++i){ order[i]=i; bounds[i]=prim_bounds(s[i]); centroids[i]=prim_centroid(s[i]); }
+        work.reserve(2*s.size());
+        work.push_back(BVHNode());
+        subdivide(0, 0, (int)s.size());
+        soa.build(s, order);
+        nodes.adopt(std::move(work)); prims.adopt(std::move(order));
+        bounds.clear(); bounds.shrink_to_fit();
+        centroids.clear(); centroids.shrink_to_fit();
+    }
+
+    // Refit to primitives that moved: leaf geometry and every node box are
+    // recomputed bottom-up (children always follow their parent in the node
+    // array), the tree shape is kept. O(n) instead of a SAH build, but the
+    // tree loosens as primitives drift from where it was built.
+    template <class P>
+    void refit(const std::vector<P>& s) {
+        std::vector<int> slots(soa.count);
+        for (int k = 0; k < soa.count; ++k) slots[k] = prim(k);
+        soa.build(s, slots);
+        std::vector<BVHNode> nb(nodes.data(), nodes.data() + nodes.size());
+        for (int ni = (int)nb.size() - 1; ni >= 0; --ni) {
+            BVHNode &n = nb[ni];
+            AABB b;
+            if (n.count > 0) for (int k = n.first; k < n.first + n.count; ++k) b.grow(prim_bounds(s[slots[k]]));
+            else { b.grow(nb[n.first].box); b.grow(nb[n.first+1].box); }
+            n.box = b;
+        }
+        nodes.adopt(std::move(nb));
+    }
+
+    // Check a tree that was not built here (a mapped scene file): children
+    // come after their parent and in range, every node is reached once,
+    // leaves cover slots below primCount, and no path is deeper than
+    // MAX_DEPTH, so traversal can neither loop, revisit shared subtrees nor
+    // overflow its stack. Linear in the node count.
+    bool valid(int primCount) const {
+        if (nodes.empty()) return primCount == 0;
+        std::vector<char> seen(nodes.size(), 0);
+        std::vector<std::pair<int,int>> todo{{0, 0}};
+        while (!todo.empty()) {
+            auto [ni, depth] = todo.back(); todo.pop_back();
+            if (seen[ni]) return false;
+            seen[ni] = 1;
+            const BVHNode &n = nodes[ni];
+            if (depth > MAX_DEPTH || n.count < 0) return false;
+            if (n.count > 0) {
+                if (n.first < 0 || n.first > primCount - n.count) return false;
+            } else {
+                if (n.first <= ni || (size_t)n.first + 1 >= nodes.size()) return false;
+                todo.push_back({n.first, depth+1}); todo.push_back({n.first+1, depth+1});
+            }
+        }
+        return true;
+    }
+
+    // closest hit, ordered front-to-back traversal
+    bool intersect(const Ray& ray, Real &t, int &id) const {
+        t = INF; id = -1;
+        if (nodes.empty()) return false;
+        Vec invD(1.0/ray.d.x, 1.0/ray.d.y, 1.0/ray.d.z);
+        if (ray_box(nodes[0].box, ray.o, invD, t) == INF) return false;
+        int stack[STACK_SIZE]; int sp = 0;
+        int ni = 0;
+        [[maybe_unused]] long long visited = 0, tests = 0;
+        for (;;) {
+            const BVHNode &n = nodes[ni];
+            STAT(++visited);
+            if (n.count > 0) {
+                STAT(tests += n.count);
+                if (useSIMD) {
+                    int slot = -1;
+                    soa.intersect(ray, n.first, n.count, t, slot);
+                    if (slot >= 0) id = prim(slot);
+                } else {
+                    for (int k=n.first; k<n.first+n.count; ++k){
+                        Real ti = soa.hit(k, ray);
+                        if (ti < t) { t = ti; id = prim(k); }
+                    }
+                }
+            } else {
+                int a = n.first, b = n.first+1;
+                Real ta = ray_box(nodes[a].box, ray.o, invD, t);
+                Real tb = ray_box(nodes[b].box, ray.o, invD, t);
+                if (tb < ta) { std::swap(a,b); std::swap(ta,tb); }
+                if (ta != INF) {
+                    if (tb != INF) { assert(sp < STACK_SIZE); stack[sp++] = b; }
+                    ni = a; continue;
+                }
+            }
+            // pop, skipping nodes whose entry lies beyond the current hit
+            for (;;) {
+                if (sp == 0) {
+                    STAT((rayCounts.nodes += visited, test_counter(soa) += tests));
+                    return id != -1;
+                }
+                ni = stack[--sp];
+                if (ray_box(nodes[ni].box, ray.o, invD, t) != INF) break;
+            }
+        }
+    }
+
+    // any hit closer than tmax; stops at the first one and reports its id.
+    // The nearer child is still visited first since blockers tend to be close.
+    bool occluded(const Ray& ray, Real tmax, int &blocker) const {
+        if (nodes.empty()) return false;
+        Vec invD(1.0/ray.d.x, 1.0/ray.d.y, 1.0/ray.d.z);
+        if (ray_box(nodes[0].box, ray.o, invD, tmax) == INF) return false;
+        int stack[STACK_SIZE]; int sp = 0;
+        stack[sp++] = 0;
+        [[maybe_unused]] long long visited = 0, tests = 0;
+        bool hit = false;
+        while (sp > 0 && !hit) {
+            const BVHNode &n = nodes[stack[--sp]];
+            STAT(++visited);
+            if (n.count == 0) {
+                int a = n.first, b = n.first+1;
+                Real ta = ray_box(nodes[a].box, ray.o, invD, tmax);
+                Real tb = ray_box(nodes[b].box, ray.o, invD, tmax);
+                if (tb < ta) { std::swap(a,b); std::swap(ta,tb); }
+                assert(sp + 2 <= STACK_SIZE);
+                if (tb != INF) stack[sp++] = b;
+                if (ta != INF) stack[sp++] = a;
+                continue;
+            }
+            STAT(tests += n.count);
+            if (useSIMD) {
+                int slot = soa.any_hit(ray, n.first, n.count, tmax);
+                if (slot >= 0) { blocker = prim(slot); hit = true; }
+            } else {
+                for (int k=n.first; k<n.first+n.count && !hit; ++k)
+                    if (soa.hit(k, ray) < tmax) { blocker = prim(k); hit = true; }
+            }
+        }
+        STAT((rayCounts.nodes += visited, test_counter(soa) += tests));
+        return hit;
+    }
+
+    // closest hits for a packet of SIMD_W coherent rays; a node is visited if any
+    // lane still needs it, children are ordered by the nearest lane entry
+    void intersect_packet(const Ray* rays, Real* tOut, int* idOut) const {
+        Real tmp[6][SIMD_W];
+        for (int l=0;l<SIMD_W;++l){
+            tmp[0][l] = rays[l].o.x; tmp[1][l] = rays[l].o.y; tmp[2][l] = rays[l].o.z;
+            tmp[3][l] = rays[l].d.x; tmp[4][l] = rays[l].d.y; tmp[5][l] = rays[l].d.z;
+        }
+        VR ox = vloadu(tmp[0]), oy = vloadu(tmp[1]), oz = vloadu(tmp[2]);
+        VR dx = vloadu(tmp[3]), dy = vloadu(tmp[4]), dz = vloadu(tmp[5]);
+        VR one(1.0);
+        VR ix = one/dx, iy = one/dy, iz = one/dz;
+        VR t(INF), slot(-1.0);
+        if (!nodes.empty()) {
+            int stack[STACK_SIZE]; int sp = 0;
+            stack[sp++] = 0;
+            [[maybe_unused]] long long visited = 0, tests = 0;
+            while (sp > 0) {
+                const BVHNode &n = nodes[stack[--sp]];
+                STAT(++visited);
+                if (!vany(box_test(n.box, ox, oy, oz, ix, iy, iz, t, nullptr))) continue;
+                if (n.count > 0) {
+                    STAT(tests += n.count * SIMD_W);
+                    soa.intersect_packet(ox, oy, oz, dx, dy, dz, n.first, n.count, t, slot);
+                    continue;
+                }
+                Real ea, eb;
+                bool ha = vany(box_test(nodes[n.first].box, ox, oy, oz, ix, iy, iz, t, &ea));
+                bool hb = vany(box_test(nodes[n.first+1].box, ox, oy, oz, ix, iy, iz, t, &eb));
+                // push the farther child first so the nearer one is popped next
+                assert(sp + 2 <= STACK_SIZE);
+                if (ha && hb) {
+                    if (ea <= eb) { stack[sp++] = n.first+1; stack[sp++] = n.first; }
+                    else          { stack[sp++] = n.first;   stack[sp++] = n.first+1; }
+                } else if (ha) stack[sp++] = n.first;
+                else if (hb) stack[sp++] = n.first+1;
+            }
+            STAT((rayCounts.nodes += visited, test_counter(soa) += tests));
+        }
+        Real st[SIMD_W];
+        vstore(tOut, t); vstore(st, slot);
+        for (int l=0;l<SIMD_W;++l) idOut[l] = st[l] < 0 ? -1 : prim((int)st[l]);
+    }
+
+private:
+    std::vector<BVHNode> work;  // nodes and primitive order while building
+    std::vector<int> order;
+    std::vector<AABB> bounds;   // per-primitive bounds, build time only
+
+    // lanes whose ray enters `b` before their current hit; *entry gets the nearest such entry
+    static VM box_test(const AABB& b, VR ox, VR oy, VR oz, VR ix, VR iy, VR iz, VR t, Real* entry) {
+        VR tx1 = (VR(b.lo.x) - ox)*ix, tx2 = (VR(b.hi.x) - ox)*ix;
+        VR tmin = vmin(tx1, tx2), tmx = vmax(tx1, tx2);
+        VR ty1 = (VR(b.lo.y) - oy)*iy, ty2 = (VR(b.hi.y) - oy)*iy;
+        tmin = vmax(tmin, vmin(ty1, ty2)); tmx = vmin(tmx, vmax(ty1, ty2));
+        VR tz1 = (VR(b.lo.z) - oz)*iz, tz2 = (VR(b.hi.z) - oz)*iz;
+        tmin = vmax(tmin, vmin(tz1, tz2)); tmx = vmin(tmx, vmax(tz1, tz2));
+        VM hit = vand(vand(vge(tmx, tmin), vlt(VR(0.0), tmx)), vlt(tmin, t));
+        if (entry) {
+            Real e[SIMD_W];
+            vstore(e, vselect(hit, tmin, VR(INF)));
+            *entry = e[0];
+            for (int l=1;l<SIMD_W;++l) *entry = std::min(*entry, e[l]);
+        }
+        return hit;
+    }
+    std::vector<Vec> centroids;
+
+    void subdivide(int ni, int first, int count, int depth = 0) {
+        AABB box, cbox;
+        for (int k=first;k<first+count;++k){ box.grow(bounds[order[k]]); cbox.grow(centroids[order[k]]); }
+        work[ni].box = box;
+        work[ni].first = first; work[ni].count = count;
+        if (count <= MAX_LEAF || depth >= MAX_DEPTH) return;
+
+        // binned SAH over the longest centroid axis
+        Vec ext = cbox.hi - cbox.lo;
+        int axis = 0; Real e = ext.x, lo = cbox.lo.x;
+        if (ext.y > e) { axis = 1; e = ext.y; lo = cbox.lo.y; }
+        if (ext.z > e) { axis = 2; e = ext.z; lo = cbox.lo.z; }
+        if (e <= 0) return; // all centroids coincide
+
+        auto comp = [axis](const Vec& v){ return axis==0 ? v.x : axis==1 ? v.y : v.z; };
+        AABB binBox[BINS]; int binCnt[BINS] = {0};
+        Real scale = BINS / e;
+        auto binOf = [&](int p){ return std::min(BINS-1, (int)((comp(centroids[p]) - lo) * scale)); };
+        for (int k=first;k<first+count;++k){ int b = binOf(order[k]); binCnt[b]++; binBox[b].grow(bounds[order[k]]); }
+
+        // sweep from the right to get suffix areas, then from the left to evaluate splits
+        Real rightArea[BINS]; int rightCnt[BINS];
+        AABB acc; int cnt = 0;
+        for (int b=BINS-1;b>0;--b){ acc.grow(binBox[b]); cnt += binCnt[b]; rightArea[b] = acc.area(); rightCnt[b] = cnt; }
+        Real bestCost = INF; int bestSplit = -1;
+        acc = AABB(); cnt = 0;
+        for (int b=0;b<BINS-1;++b){
+            acc.grow(binBox[b]); cnt += binCnt[b];
+            if (cnt == 0 || rightCnt[b+1] == 0) continue;
+            Real cost = acc.area()*cnt + rightArea[b+1]*rightCnt[b+1];
+            if (cost < bestCost) { bestCost = cost; bestSplit = b; }
+        }
+        Real leafCost = box.area() * count;
+        if (bestSplit < 0 || (bestCost >= leafCost && count <= FORCE_SPLIT)) return;
+
+        int* mid = std::partition(&order[first], &order[first]+count,
+                                  [&](int p){ return binOf(p) <= bestSplit; });
+        int leftCount = (int)(mid - &order[first]);
+        if (leftCount == 0 || leftCount == count) return;
+
+        int l = (int)work.size();
+        work.push_back(BVHNode()); work.push_back(BVHNode());
+        work[ni].first = l; work[ni].count = 0;
+        subdivide(l, first, leftCount, depth+1);
+        subdivide(l+1, first+leftCount, count-leftCount, depth+1);
+    }
+};
+typedef BVHT<SphereSoA> BVH;
+BVH bvh;
+BVHT<TriangleSoA> triBVH; // standalone and mesh triangles, indices into triangleIds
+std::vector<int> triangleIds; // hit id of each triangle in triBVH
+bool useBVH = true;
+
+// find closest hit by scanning every sphere
+bool scene_intersect_linear(const Ray& ray, Real &t, int &id) {
     t = INF; id = -1;
+    STAT(rayCounts.sphereTests += scene_size());
+    if (mappedScene.count) {
+        for (int i=0;i<(int)mappedScene.count;++i){
+            Real ti = intersect_sphere(sphere_center(i), mappedScene.r[i], ray);
+            if (ti < t) { t = ti; id = i; }
+        }
+        return id != -1;
+    }
     for (int i=0;i<(int)spheres.size();++i){
-        double ti = spheres[i].intersect(ray);
+        Real ti = spheres[i].intersect(ray);
         if (ti < t) { t = ti; id = i; }
     }
     return id != -1;
 }
 
-// simple direct illumination with shadows and single reflection bounce
-Vec trace(const Ray& ray, int depth=0) {
-    if (depth > 3) return Vec(0,0,0); // limit recursion
+inline bool scene_has_flat() { return !planes.empty() || !triangles.empty() || !meshes.empty(); }
+
+// closest hit against planes, triangles and meshes; only improves t/id.
+// Each type is scanned as its own homogeneous array (triangles through triBVH
+// when it is built), so no test dispatches on primitive type.
+void intersect_flat(const Ray& ray, Real &t, int &id) {
+    STAT(rayCounts.flatTests += planes.size());
+    for (int i=0;i<(int)planes.size();++i){
+        Real ti = planes[i].intersect(ray);
+        if (ti < t) { t = ti; id = prim_id(PRIM_PLANE, i); }
+    }
+    if (useBVH && triBVH.built()) {
+        Real tt; int k;
+        if (triBVH.intersect(ray, tt, k) && tt < t) { t = tt; id = triangleIds[k]; }
+        return;
+    }
+    for (int i=0;i<(int)triangles.size();++i){
+        Real ti = triangles[i].intersect(ray);
+        if (ti < t) { t = ti; id = prim_id(PRIM_TRIANGLE, i); }
+    }
+    int g = 0;
+    for (const Mesh &m : meshes)
+        for (int tri=0; tri<m.triangles(); ++tri, ++g){
+            Vec a = m.corner(tri, 0);
+            Real ti = intersect_triangle(a, m.corner(tri, 1) - a, m.corner(tri, 2) - a, ray);
+            if (ti < t) { t = ti; id = prim_id(PRIM_MESH, g); }
+        }
+    STAT(rayCounts.flatTests += triangles.size() + g);
+}
 
-    double t; int id;
-    if (!scene_intersect(ray, t, id)) {
-        // background gradient
-        double tunit = 0.5*(normalize(ray.d).y + 1.0);
-        return Vec(0.7,0.8,1.0)*(1.0 - tunit) + Vec(1.0,1.0,1.0)*tunit;
+// any plane, triangle or mesh hit closer than tmax
+bool occluded_flat(const Ray& ray, Real tmax, int &blocker) {
+    for (int i=0;i<(int)planes.size();++i)
+        if (planes[i].intersect(ray) < tmax) {
+            STAT(rayCounts.flatTests += i + 1);
+            blocker = prim_id(PRIM_PLANE, i); return true;
+        }
+    STAT(rayCounts.flatTests += planes.size());
+    if (useBVH && triBVH.built()) {
+        int k;
+        if (!triBVH.occluded(ray, tmax, k)) return false;
+        blocker = triangleIds[k]; return true;
     }
+    for (int i=0;i<(int)triangles.size();++i)
+        if (triangles[i].intersect(ray) < tmax) {
+            STAT(rayCounts.flatTests += i + 1);
+            blocker = prim_id(PRIM_TRIANGLE, i); return true;
+        }
+    STAT(rayCounts.flatTests += triangles.size());
+    int g = 0;
+    for (const Mesh &m : meshes)
+        for (int tri=0; tri<m.triangles(); ++tri, ++g){
+            Vec a = m.corner(tri, 0);
+            if (intersect_triangle(a, m.corner(tri, 1) - a, m.corner(tri, 2) - a, ray) < tmax) {
+                STAT(rayCounts.flatTests += g + 1);
+                blocker = prim_id(PRIM_MESH, g); return true;
+            }
+        }
+    STAT(rayCounts.flatTests += g);
+    return false;
+}
+
+// find closest hit
+bool scene_intersect(const Ray& ray, Real &t, int &id) {
+    if (useBVH && bvh.built()) bvh.intersect(ray, t, id);
+    else scene_intersect_linear(ray, t, id);
+    if (scene_has_flat()) intersect_flat(ray, t, id);
+    return id != -1;
+}
 
-    const Sphere &obj = spheres[id];
-    Vec hit = ray.o + ray.d * t;
-    Vec N = normalize(hit - obj.c);
+// triangles and mesh triangles gathered into one BVH
+void build_triangle_bvh() {
+    index_meshes();
+    std::vector<TriangleRec> recs;
+    for (int i=0;i<(int)triangles.size();++i)
+        recs.push_back({triangles[i].a, triangles[i].b, triangles[i].c, prim_id(PRIM_TRIANGLE, i)});
+    for (int m=0;m<(int)meshes.size();++m)
+        for (int tri=0;tri<meshes[m].triangles();++tri)
+            recs.push_back({meshes[m].corner(tri, 0), meshes[m].corner(tri, 1), meshes[m].corner(tri, 2),
+                            prim_id(PRIM_MESH, meshFirst[m] + tri)});
+    triangleIds.resize(recs.size());
+    for (size_t k=0;k<recs.size();++k) triangleIds[k] = recs[k].id;
+    triBVH.build(recs);
+}
 
-    // simple ambient + diffuse + specular
-    Vec col = obj.m.color * 0.05; // ambient
+// drop every primitive and go back to the default light (the spheres' BVH is
+// rebuilt by whoever builds a scene)
+void clear_scene() {
+    spheres.clear(); planes.clear(); triangles.clear(); meshes.clear();
+    build_triangle_bvh();
+    lights.assign(1, default_light());
+    lightTable.build(lights);
+}
 
-    // define a single point light
-    Vec lightPos(5, 10, -2);
-    Vec lightCol(1.0, 1.0, 1.0);
-    Vec toLight = normalize(lightPos - hit);
-    double nl = std::max(0.0, dot(N, toLight));
+// Is anything hit closer than tmax? Shadow rays only need this yes/no
+// answer, so the search stops at the first blocker instead of the closest.
+// Each thread remembers the primitive that last blocked a shadow ray and tries
+// it first: neighbouring shadow rays are usually blocked by the same one.
+bool useOccluderCache = true;
+thread_local int lastOccluder = -1;
 
-    // shadow check
-    Ray shadowRay(hit + N * 1e-4, toLight);
-    double ts; int sid;
-    bool inShadow = scene_intersect(shadowRay, ts, sid) && ts < std::sqrt(dot(lightPos - hit, lightPos - hit)) - 1e-6;
-
-    if (!inShadow) {
-        // diffuse
-        col = col + obj.m.color * (nl * 0.9) * lightCol;
-        // simple Blinn-Phong specular
-        Vec viewDir = normalize(ray.o - hit);
-        Vec halfv = normalize(viewDir + toLight);
-        double spec = pow(std::max(0.0, dot(N, halfv)), 64);
-        col = col + lightCol * (spec * 0.6);
-    } else {
-        // slightly darken when in shadow
-        col = col * 0.4;
+bool occluded(const Ray& ray, Real tmax) {
+    if (useOccluderCache && lastOccluder >= 0) {
+        bool cached = prim_hit(lastOccluder, ray) < tmax;
+        STAT((prim_kind(lastOccluder) == PRIM_SPHERE ? ++rayCounts.sphereTests : ++rayCounts.flatTests,
+              rayCounts.cacheHits += cached, rayCounts.occluded += cached));
+        if (cached) return true;
     }
-
-    // reflection
-    if (obj.m.reflect > 1e-6) {
-        Vec reflDir = normalize(reflect(ray.d, N));
-        Ray reflRay(hit + N * 1e-4, reflDir);
-        Vec reflCol = trace(reflRay, depth+1);
-        col = col*(1.0 - obj.m.reflect) + reflCol * obj.m.reflect;
+    int blocker = -1;
+    bool hit = false;
+    if (useBVH && bvh.built()) hit = bvh.occluded(ray, tmax, blocker);
+    else {
+        int i = 0;
+        for (; i<scene_size() && !hit; ++i)
+            if (intersect_sphere(sphere_center(i), sphere_radius(i), ray) < tmax) { hit = true; blocker = i; }
+        STAT(rayCounts.sphereTests += i);
     }
-
-    // clamp to [0,1]
-    col.x = std::min(1.0, std::max(0.0, col.x));
-    col.y = std::min(1.0, std::max(0.0, col.y));
-    col.z = std::min(1.0, std::max(0.0, col.z));
-    return col;
+    if (!hit && scene_has_flat()) hit = occluded_flat(ray, tmax, blocker);
+    if (hit) lastOccluder = blocker;
+    STAT(rayCounts.occluded += hit);
+    return hit;
 }
 
-int main(){
-    // build a simple scene
-    spheres.push_back(Sphere(Vec(0.0, -10004, -20), 10000, Material(Vec(0.8,0.8,0.8), 0.0))); // ground as big sphere
+// the original three-sphere scene; groundPlane swaps the ground sphere for the
+// plane y = -4 it approximates
+void build_demo_scene(bool groundPlane = false) {
+    clear_scene();
+    if (groundPlane) planes.push_back(Plane(Vec(0.0, 1.0, 0.0), -4, Material(Vec(0.8,0.8,0.8), 0.0)));
+    else spheres.push_back(Sphere(Vec(0.0, -10004, -20), 10000, Material(Vec(0.8,0.8,0.8), 0.0))); // ground as big sphere
     spheres.push_back(Sphere(Vec(0.0, 0.0, -6), 1.0, Material(Vec(0.9,0.1,0.1), 0.25))); // red sphere
     spheres.push_back(Sphere(Vec(2.0, 0.2, -7), 1.2, Material(Vec(0.1,0.3,0.9), 0.5)));  // blue reflective
+}
 
-    // image
-    const int width = 800;
-    const int height = 600;
-    const double fov = M_PI/3.0; // 60 degrees
+// random spheres filling a box in front of the camera; radius shrinks with n
+// so the scene keeps roughly the same density of free space
+void build_random_scene(int n, unsigned seed = 1, Real reflectFrac = 0.2) {
+    clear_scene(); spheres.reserve(n);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> ux(-40, 40), uy(-30, 30), uz(-120, -20), u01(0, 1);
+    double r = 0.2 * std::cbrt(80.0*60.0*100.0 / std::max(n,1));
+    for (int i=0;i<n;++i){
+        Vec c(ux(rng), uy(rng), uz(rng));
+        Material m(Vec(u01(rng), u01(rng), u01(rng)), u01(rng) < reflectFrac ? 0.5 : 0.0);
+        spheres.push_back(Sphere(c, r*(0.5 + u01(rng)), m));
+    }
+}
+
+// ---------- binary scene files ----------
+// Version 1 layout; native Reals, every section starts on a 64-byte boundary:
+//   SceneFileHeader
+//   cx, cy, cz, r   Real[paddedCount]     sphere SoA, padded like SphereSoA
+//   matIndex        uint32[sphereCount]   index into the material table
+//   materials       Material[materialCount]
+//   nodes           BVHNode[nodeCount]    only if flags & SCENE_HAS_BVH
+// SCENE_FLOAT / SCENE_VEC4 record the Real type and vector layout the file was
+// written with; a build only accepts files matching its own layout.
+// When a BVH is present the spheres are stored in its leaf order, so a
+// sphere's BVH slot is also its id and the file can be used without copying.
+const char SCENE_MAGIC[8] = {'M','I','N','I','R','T','S','C'};
+const uint32_t SCENE_VERSION = 1;
+const uint32_t SCENE_HAS_BVH = 1;
+const uint32_t SCENE_FLOAT = 2;
+const uint32_t SCENE_VEC4 = 4;
+const uint32_t SCENE_LAYOUT = (sizeof(Real) == sizeof(float) ? SCENE_FLOAT : 0) | (VEC4_LAYOUT ? SCENE_VEC4 : 0);
+
+struct SceneFileHeader {
+    char magic[8];
+    uint32_t version, flags;
+    uint64_t sphereCount, paddedCount, materialCount, nodeCount;
+    uint64_t offCx, offCy, offCz, offR, offMatIndex, offMaterials, offNodes;
+    uint64_t fileSize;
+};
+static_assert(std::is_trivially_copyable<Material>::value, "Material is stored raw in scene files");
+static_assert(std::is_trivially_copyable<BVHNode>::value, "BVHNode is stored raw in scene files");
+
+inline uint64_t align64(uint64_t off) { return (off + 63) & ~uint64_t(63); }
+
+// write `spheres` to a binary scene file, optionally with a prebuilt BVH
+bool save_scene_file(const std::string& path, bool withBVH) {
+    if (scene_has_flat()) { std::cerr << "binary scene files hold spheres only; use a text scene\n"; return false; }
+    if (withBVH && !bvh.built()) bvh.build(spheres);
+    size_t n = spheres.size();
+    std::vector<int> order(n);
+    for (size_t i=0;i<n;++i) order[i] = withBVH ? bvh.prims[i] : (int)i;
+
+    // material table with exact duplicates merged
+    struct KeyHash {
+        size_t operator()(const std::array<double,4>& k) const {
+            size_t h = 0;
+            for (double d : k) h = h*1000003u ^ std::hash<double>()(d);
+            return h;
+        }
+    };
+    std::unordered_map<std::array<double,4>, uint32_t, KeyHash> matIds;
+    std::vector<Material> materials;
+    std::vector<uint32_t> matIndex(n);
+    for (size_t k=0;k<n;++k){
+        const Material &m = spheres[order[k]].m;
+        std::array<double,4> key = {m.color.x, m.color.y, m.color.z, m.reflect};
+        auto it = matIds.find(key);
+        if (it == matIds.end()) {
+            it = matIds.emplace(key, (uint32_t)materials.size()).first;
+            materials.push_back(m);
+        }
+        matIndex[k] = it->second;
+    }
 
-    std::vector<unsigned char> img(width * height * 3);
+    SceneFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, SCENE_MAGIC, sizeof(h.magic));
+    h.version = SCENE_VERSION;
+    h.flags = (withBVH ? SCENE_HAS_BVH : 0) | SCENE_LAYOUT;
+    h.sphereCount = n;
+    h.paddedCount = SphereSoA::padded_size(n);
+    h.materialCount = materials.size();
+    h.nodeCount = withBVH ? bvh.nodes.size() : 0;
+    uint64_t off = align64(sizeof(h));
+    uint64_t soaBytes = h.paddedCount * sizeof(Real);
+    h.offCx = off; off = align64(off + soaBytes);
+    h.offCy = off; off = align64(off + soaBytes);
+    h.offCz = off; off = align64(off + soaBytes);
+    h.offR  = off; off = align64(off + soaBytes);
+    h.offMatIndex  = off; off = align64(off + n*sizeof(uint32_t));
+    h.offMaterials = off; off = align64(off + materials.size()*sizeof(Material));
+    h.offNodes     = off; off = off + h.nodeCount*sizeof(BVHNode);
+    h.fileSize = off;
 
-    Vec camPos(0, 0, 0);
+    std::vector<char> file(h.fileSize, 0);
+    std::memcpy(&file[0], &h, sizeof(h));
+    Real *cx = (Real*)&file[h.offCx], *cy = (Real*)&file[h.offCy];
+    Real *cz = (Real*)&file[h.offCz], *r = (Real*)&file[h.offR];
+    for (size_t k=0;k<n;++k){
+        const Sphere &s = spheres[order[k]];
+        cx[k] = s.c.x; cy[k] = s.c.y; cz[k] = s.c.z; r[k] = s.r;
+    }
+    if (n) std::memcpy(&file[h.offMatIndex], matIndex.data(), n*sizeof(uint32_t));
+    if (!materials.empty()) std::memcpy(&file[h.offMaterials], materials.data(), materials.size()*sizeof(Material));
+    if (h.nodeCount) std::memcpy(&file[h.offNodes], bvh.nodes.data(), h.nodeCount*sizeof(BVHNode));
+
+    std::ofstream ofs(path, std::ios::binary);
+    ofs.write(file.data(), file.size());
+    if (!ofs) { std::cerr << "cannot write " << path << "\n"; return false; }
+    return true;
+}
+
+// does the file start with the binary scene magic? (otherwise it is read as text)
+bool is_scene_file(const std::string& path) {
+    char magic[sizeof(SCENE_MAGIC)] = {0};
+    std::ifstream in(path, std::ios::binary);
+    in.read(magic, sizeof(magic));
+    return std::memcmp(magic, SCENE_MAGIC, sizeof(magic)) == 0;
+}
+
+// map a binary scene file. With a stored BVH the sphere data and nodes are
+// used straight from the mapping; without one the spheres are copied into
+// `spheres` and the BVH is built as usual.
+bool load_scene_file(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) { std::cerr << "cannot open " << path << "\n"; return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SceneFileHeader)) {
+        std::cerr << path << ": not a scene file\n"; close(fd); return false;
+    }
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { std::cerr << "cannot map " << path << "\n"; return false; }
+
+    const char* bytes = (const char*)base;
+    SceneFileHeader h;
+    std::memcpy(&h, bytes, sizeof(h));
+    auto fits = [&](uint64_t off, uint64_t size) { return off % 64 == 0 && off <= h.fileSize && size <= h.fileSize - off; };
+    bool ok = std::memcmp(h.magic, SCENE_MAGIC, sizeof(h.magic)) == 0
+           && h.version == SCENE_VERSION
+           && (h.flags & (SCENE_FLOAT | SCENE_VEC4)) == SCENE_LAYOUT
+           && h.fileSize == (uint64_t)st.st_size
+           && h.sphereCount <= (uint64_t)std::numeric_limits<int>::max()
+           && h.paddedCount == SphereSoA::padded_size(h.sphereCount)
+           && fits(h.offCx, h.paddedCount*sizeof(Real)) && fits(h.offCy, h.paddedCount*sizeof(Real))
+           && fits(h.offCz, h.paddedCount*sizeof(Real)) && fits(h.offR, h.paddedCount*sizeof(Real))
+           && fits(h.offMatIndex, h.sphereCount*sizeof(uint32_t))
+           && fits(h.offMaterials, h.materialCount*sizeof(Material))
+           && fits(h.offNodes, h.nodeCount*sizeof(BVHNode))
+           && (!(h.flags & SCENE_HAS_BVH) || h.nodeCount > 0 || h.sphereCount == 0);
+    if (!ok) {
+        std::cerr << path << ": bad or unsupported scene file\n";
+        munmap(base, st.st_size); return false;
+    }
 
-    for (int j = 0; j < height; ++j) {
-        for (int i = 0; i < width; ++i) {
-            // normalized device coords
-            double x = (2 * (i + 0.5) / (double)width  - 1) * tan(fov/2.0) * (width / (double)height);
-            double y = (1 - 2 * (j + 0.5) / (double)height) * tan(fov/2.0);
+    MappedScene m;
+    m.base = base; m.bytes = st.st_size;
+    m.count = h.sphereCount;
+    m.cx = (const Real*)(bytes + h.offCx); m.cy = (const Real*)(bytes + h.offCy);
+    m.cz = (const Real*)(bytes + h.offCz); m.r  = (const Real*)(bytes + h.offR);
+    m.matIndex = (const uint32_t*)(bytes + h.offMatIndex);
+    m.materials = (const Material*)(bytes + h.offMaterials);
+    m.materialCount = h.materialCount;
+    for (size_t k=0;k<m.count;++k)
+        if (m.matIndex[k] >= m.materialCount) {
+            std::cerr << path << ": material index out of range\n";
+            munmap(base, st.st_size); return false;
+        }
 
-            Ray ray(camPos, normalize(Vec(x, y, -1)));
-            Vec color = trace(ray, 0);
+    clear_scene();
+    if (h.flags & SCENE_HAS_BVH) {
+        mappedScene = m;
+        bvh.nodes.view((const BVHNode*)(bytes + h.offNodes), h.nodeCount);
+        bvh.prims.view(nullptr, 0); // leaf order == id order
+        bvh.soa.count = (int)m.count;
+        bvh.soa.cx.view(m.cx, h.paddedCount); bvh.soa.cy.view(m.cy, h.paddedCount);
+        bvh.soa.cz.view(m.cz, h.paddedCount); bvh.soa.r.view(m.r, h.paddedCount);
+        if (bvh.valid((int)m.count)) return true;
+        std::cerr << path << ": stored BVH is malformed or deeper than " << BVH::MAX_DEPTH
+                  << " levels, rebuilding it\n";
+        mappedScene = MappedScene();
+    }
+    spheres.reserve(m.count);
+    for (size_t k=0;k<m.count;++k)
+        spheres.push_back(Sphere(Vec(m.cx[k], m.cy[k], m.cz[k]), m.r[k], m.materials[m.matIndex[k]]));
+    munmap(base, st.st_size);
+    bvh.build(spheres);
+    return true;
+}
 
-            // gamma correction (approx)
-            auto to8 = [](double c)->unsigned char {
-                c = std::pow(std::max(0.0, std::min(1.0, c)), 1.0/2.2);
-                return (unsigned char)(std::round(c * 255.0));
-            };
+// one OBJ-style face: 1-based vertex indices (negative counts back from the
+// last vertex, "i/t/n" forms are accepted), polygons are split into a fan
+bool parse_face(std::istringstream& ls, int vertCount, std::vector<int>& index) {
+    std::vector<int> poly;
+    std::string tok;
+    while (ls >> tok) {
+        int v = std::atoi(tok.substr(0, tok.find('/')).c_str());
+        v = v < 0 ? vertCount + v : v - 1;
+        if (v < 0 || v >= vertCount) return false;
+        poly.push_back(v);
+    }
+    if (poly.size() < 3) return false;
+    for (size_t k=1;k+1<poly.size();++k){ index.push_back(poly[0]); index.push_back(poly[k]); index.push_back(poly[k+1]); }
+    return true;
+}
 
-            int idx = (j*width + i) * 3;
-            img[idx+0] = to8(color.x);
-            img[idx+1] = to8(color.y);
-            img[idx+2] = to8(color.z);
+// Wavefront OBJ as one mesh; only v and f lines are used, the rest is ignored
+bool load_obj(const std::string& path, const Material& m) {
+    std::ifstream in(path);
+    if (!in) { std::cerr << "cannot open " << path << "\n"; return false; }
+    Mesh mesh;
+    mesh.m = m;
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+        std::istringstream ls(line);
+        std::string kind;
+        if (!(ls >> kind)) continue;
+        double x, y, z;
+        if (kind == "v" && ls >> x >> y >> z) mesh.verts.push_back(Vec(x,y,z));
+        else if (kind == "f" && !parse_face(ls, (int)mesh.verts.size(), mesh.index)) {
+            std::cerr << path << ":" << lineNo << ": bad face '" << line << "'\n";
+            return false;
         }
-        if ((j%50)==0) std::cout << "scanline " << j << "/" << height << "\n";
     }
+    meshes.push_back(std::move(mesh));
+    return true;
+}
 
-    // write PPM
-    std::ofstream ofs("scene.ppm", std::ios::binary);
-    ofs << "P6\n" << width << " " << height << "\n255\n";
-    ofs.write(reinterpret_cast<char*>(img.data()), img.size());
-    ofs.close();
+// Text scenes, one statement per line, '#' starts a comment:
+//   material <name> <r> <g> <b> <reflect>
+//   sphere <x> <y> <z> <radius> <material name>
+//   plane <nx> <ny> <nz> <d> <material name>          (points with dot(n,p) == d)
+//   triangle <x0> <y0> <z0> <x1> <y1> <z1> <x2> <y2> <z2> <material name>
+//   mesh <material name>   followed by OBJ-style "v x y z" and "f i j k ..." lines
+//   obj <file> <material name>
+//   light point <x> <y> <z> <r> <g> <b> [falloff]
+//   light directional <dx> <dy> <dz> <r> <g> <b>
+//   light sphere <x> <y> <z> <radius> <r> <g> <b> [falloff]
+// Without any light statement the scene gets the default key light.
+bool load_scene_text(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) { std::cerr << "cannot open " << path << "\n"; return false; }
+    std::map<std::string, Material> materials;
+    clear_scene();
+    Mesh* mesh = nullptr; // mesh that v/f lines go to
+    lights.clear();
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ls(line);
+        std::string kind;
+        if (!(ls >> kind)) continue;
+        std::string name;
+        auto material = [&](const Material*& m) {
+            auto it = materials.find(name);
+            if (it == materials.end()) {
+                std::cerr << path << ":" << lineNo << ": unknown material '" << name << "'\n";
+                return false;
+            }
+            m = &it->second; return true;
+        };
+        const Material* m = nullptr;
+        if (kind != "v" && kind != "f") mesh = nullptr;
+        if (kind == "material") {
+            double r, g, b, refl;
+            if (ls >> name >> r >> g >> b >> refl) { materials[name] = Material(Vec(r,g,b), refl); continue; }
+        } else if (kind == "sphere") {
+            double x, y, z, rad;
+            if (ls >> x >> y >> z >> rad >> name) {
+                if (!material(m)) return false;
+                spheres.push_back(Sphere(Vec(x,y,z), rad, *m));
+                continue;
+            }
+        } else if (kind == "plane") {
+            double x, y, z, d;
+            if (ls >> x >> y >> z >> d >> name) {
+                if (!material(m)) return false;
+                planes.push_back(Plane(Vec(x,y,z), d, *m));
+                continue;
+            }
+        } else if (kind == "triangle") {
+            double c[9];
+            int k = 0;
+            while (k < 9 && ls >> c[k]) ++k;
+            if (k == 9 && ls >> name) {
+                if (!material(m)) return false;
+                triangles.push_back(Triangle(Vec(c[0],c[1],c[2]), Vec(c[3],c[4],c[5]), Vec(c[6],c[7],c[8]), *m));
+                continue;
+            }
+        } else if (kind == "mesh") {
+            if (ls >> name) {
+                if (!material(m)) return false;
+                meshes.push_back(Mesh());
+                mesh = &meshes.back();
+                mesh->m = *m;
+                continue;
+            }
+        } else if (kind == "v" && mesh) {
+            double x, y, z;
+            if (ls >> x >> y >> z) { mesh->verts.push_back(Vec(x,y,z)); continue; }
+        } else if (kind == "f" && mesh) {
+            if (parse_face(ls, (int)mesh->verts.size(), mesh->index)) continue;
+        } else if (kind == "light") {
+            std::string type, opt;
+            double x, y, z, rad = 0, r, g, b;
+            if (ls >> type >> x >> y >> z && (type != "sphere" || ls >> rad) && ls >> r >> g >> b) {
+                bool falloff = (ls >> opt) && opt == "falloff";
+                if (type == "point") { lights.push_back(Light::point(Vec(x,y,z), Vec(r,g,b), falloff)); continue; }
+                if (type == "directional") { lights.push_back(Light::directional(Vec(x,y,z), Vec(r,g,b))); continue; }
+                if (type == "sphere") { lights.push_back(Light::sphere(Vec(x,y,z), rad, Vec(r,g,b), falloff)); continue; }
+            }
+        } else if (kind == "obj") {
+            std::string file;
+            if (ls >> file >> name) {
+                if (!material(m) || !load_obj(file, *m)) return false;
+                continue;
+            }
+        }
+        std::cerr << path << ":" << lineNo << ": cannot parse '" << line << "'\n";
+        return false;
+    }
+    if (lights.empty()) lights.push_back(default_light());
+    lightTable.build(lights);
+    return true;
+}
+
+// write the scene as text, one material per primitive; meshes are written inline
+bool save_scene_text(const std::string& path) {
+    std::ofstream out(path);
+    out.precision(17);
+    int mi = 0;
+    auto material = [&](const Material& m) {
+        out << "material m" << mi << " " << m.color.x << " " << m.color.y << " " << m.color.z
+            << " " << m.reflect << "\n";
+        return " m" + std::to_string(mi++) + "\n";
+    };
+    for (const Sphere &s : spheres) {
+        std::string name = material(s.m);
+        out << "sphere " << s.c.x << " " << s.c.y << " " << s.c.z << " " << s.r << name;
+    }
+    for (const Plane &p : planes) {
+        std::string name = material(p.m);
+        out << "plane " << p.n.x << " " << p.n.y << " " << p.n.z << " " << p.d << name;
+    }
+    for (const Triangle &t : triangles) {
+        std::string name = material(t.m);
+        out << "triangle";
+        for (const Vec &v : {t.a, t.b, t.c}) out << " " << v.x << " " << v.y << " " << v.z;
+        out << name;
+    }
+    for (const Mesh &m : meshes) {
+        std::string name = material(m.m);
+        out << "mesh" << name;
+        for (const Vec &v : m.verts) out << "v " << v.x << " " << v.y << " " << v.z << "\n";
+        for (size_t k=0;k<m.index.size();k+=3)
+            out << "f " << m.index[k]+1 << " " << m.index[k+1]+1 << " " << m.index[k+2]+1 << "\n";
+    }
+    for (const Light &l : lights) {
+        const Vec &c = l.color;
+        if (l.kind == LIGHT_POINT) out << "light point " << l.pos.x << " " << l.pos.y << " " << l.pos.z;
+        else if (l.kind == LIGHT_DIRECTIONAL) out << "light directional " << l.dir.x << " " << l.dir.y << " " << l.dir.z;
+        else out << "light sphere " << l.pos.x << " " << l.pos.y << " " << l.pos.z << " " << l.radius;
+        out << " " << c.x << " " << c.y << " " << c.z << (l.falloff ? " falloff" : "") << "\n";
+    }
+    if (!out) { std::cerr << "cannot write " << path << "\n"; return false; }
+    return true;
+}
+
+// first-hit auxiliary outputs (AOVs) that guide the denoiser; a miss has a
+// zero normal, the background as albedo and MISS_DEPTH
+struct AOV { Vec normal, albedo; Real depth; };
+const float MISS_DEPTH = 1e30f;
+
+Vec trace(const Ray& ray, int depth=0, AOV* aov=nullptr);
+
+int maxDepth = 3; // deepest reflection level that is still traced
+
+// Shadow rays per shading point. Scenes with at most this many lights light
+// every hit with all of them; bigger light lists are sampled through lightTable,
+// so the cost per hit stays the same however many lights there are.
+int lightSamples = 1;
+const int MAX_LIGHT_SAMPLES = 64; // one bit each in a shadow mask
+
+// deterministic per-hit random numbers: hashed from the hit point, so every
+// render mode and thread count picks the same light samples
+inline uint64_t mix64(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+inline uint64_t hash_point(const Vec& p) {
+    const Real c[3] = {p.x, p.y, p.z};
+    uint64_t h = 0;
+    for (Real v : c) { uint64_t b = 0; std::memcpy(&b, &v, sizeof(Real)); h = mix64(h ^ b); }
+    return h;
+}
+inline Real hash01(uint64_t seed, int k) { return (Real)((mix64(seed + k) >> 11) * (1.0 / 9007199254740992.0)); }
+
+// one light as seen from a hit point: direction, shadow ray and the
+// intensity it contributes (already divided by its selection probability)
+struct LightSample {
+    Vec toLight, radiance;
+    Ray shadowRay;
+    Real dist;
+};
+
+inline Vec background(const Ray& ray) {
+    // background gradient
+    Real tunit = 0.5*(normalize(ray.d).y + 1.0);
+    return Vec(0.7,0.8,1.0)*(1.0 - tunit) + Vec(1.0,1.0,1.0)*tunit;
+}
+
+// everything needed to light a hit point, split so the shadow query can be
+// answered separately (inline by trace(), in bulk by the wavefront renderer)
+struct SurfaceHit {
+    const Material* mat;
+    Vec hit, N;
+    uint64_t seed; // light sampling random stream
+    SurfaceHit() : mat(nullptr), seed(0) {}
+    SurfaceHit(const Ray& ray, Real t, int id) : mat(&prim_material(id)) {
+        hit = ray.o + ray.d * t;
+        N = prim_normal(id, hit, ray);
+        seed = hash_point(hit); // also jitters sphere lights when every light is evaluated
+    }
+
+    int light_samples() const { return std::min((int)lights.size(), lightSamples); }
+
+    // sample k: light k itself when every light is used, otherwise a light
+    // picked by power from stratum k of [0,1)
+    LightSample light_sample(int k) const {
+        int n = light_samples();
+        int li = k;
+        Real weight = 1;
+        if ((int)lights.size() > n) {
+            Real p;
+            li = lightTable.sample((k + hash01(seed, 3*k)) / n, p);
+            weight = 1 / (p * n);
+        }
+        const Light &l = lights[li];
+        LightSample s;
+        if (l.kind == LIGHT_DIRECTIONAL) {
+            s.toLight = l.dir * Real(-1);
+            s.dist = INF;
+        } else {
+            Vec target = l.pos;
+            if (l.kind == LIGHT_SPHERE) { // uniform point on the half facing the hit
+                Real z = 1 - 2*hash01(seed, 3*k+1), phi = 2*M_PI*hash01(seed, 3*k+2);
+                Real rxy = std::sqrt(std::max(Real(0), 1 - z*z));
+                Vec v(rxy*std::cos(phi), rxy*std::sin(phi), z);
+                if (dot(v, hit - l.pos) < 0) v = v * Real(-1);
+                target = l.pos + v * l.radius;
+            }
+            Vec L = target - hit;
+            s.dist = std::sqrt(dot(L, L));
+            s.toLight = L / (s.dist>0? s.dist:1); // same as normalize(L), one sqrt
+            if (l.falloff) weight /= std::max(s.dist*s.dist, Real(1e-4));
+        }
+        s.radiance = l.color * weight;
+        s.shadowRay = Ray(hit + N * BIAS, s.toLight);
+        return s;
+    }
+
+    // bit k set if light sample k is blocked (anything closer than the light
+    // along its shadow ray)
+    uint64_t in_shadow() const {
+        uint64_t mask = 0;
+        for (int k = 0; k < light_samples(); ++k) {
+            ++rayCounts.shadow;
+            LightSample s = light_sample(k);
+            if (occluded(s.shadowRay, s.dist - 1e-6)) mask |= uint64_t(1) << k;
+        }
+        return mask;
+    }
+
+    // simple ambient + diffuse + specular, before reflection
+    Vec local(const Ray& ray, uint64_t shadowMask) const {
+        Vec col = mat->color * 0.05; // ambient
+        int n = light_samples(), blocked = __builtin_popcountll(shadowMask);
+        // slightly darken when in shadow
+        if (blocked) col = col * (1 - 0.6 * blocked / n);
+        if (blocked == n) return col;
+        Vec viewDir = normalize(ray.o - hit);
+        for (int k = 0; k < n; ++k) {
+            if (shadowMask >> k & 1) continue;
+            LightSample s = light_sample(k);
+            Real nl = std::max(Real(0), dot(N, s.toLight));
+            // diffuse
+            col = col + mat->color * (nl * 0.9) * s.radiance;
+            // simple Blinn-Phong specular
+            Vec halfv = normalize(viewDir + s.toLight);
+            Real spec = pow(std::max(Real(0), dot(N, halfv)), 64);
+            col = col + s.radiance * (spec * 0.6);
+        }
+        return col;
+    }
+    bool reflective() const { return mat->reflect > 1e-6; }
+    Ray reflected(const Ray& ray) const { return Ray(hit + N * BIAS, normalize(reflect(ray.d, N))); }
+    // blend the local colour with the reflected colour; radiance stays
+    // unclamped, the output stage tone maps it
+    Vec combine(const Vec& local, const Vec& reflCol) const {
+        Vec col = local;
+        if (reflective()) col = col*(1.0 - mat->reflect) + reflCol * mat->reflect;
+        return col;
+    }
+};
+
+// shade a ray whose closest hit (if any) is already known; fills *aov if given
+Vec shade(const Ray& ray, bool hitAny, Real t, int id, int depth, AOV* aov = nullptr) {
+    if (!hitAny) {
+        Vec bg = background(ray);
+        if (aov) *aov = {Vec(), bg, MISS_DEPTH};
+        return bg;
+    }
 
-    std::cout << "Wrote scene.ppm (" << width << "x" << height << ")\n";
+    SurfaceHit s(ray, t, id);
+    if (aov) *aov = {s.N, s.mat->color, t};
+
+    // shadow check
+    Vec col = s.local(ray, s.in_shadow());
+
+    // reflection
+    Vec reflCol;
+    if (s.reflective()) reflCol = trace(s.reflected(ray), depth+1);
+    return s.combine(col, reflCol);
+}
+
+// simple direct illumination with shadows and reflection bounces
+Vec trace(const Ray& ray, int depth, AOV* aov) {
+    if (depth > maxDepth) return Vec(0,0,0); // limit recursion
+    if (depth == 0) ++rayCounts.primary; else ++rayCounts.reflection;
+
+    Real t; int id;
+    bool hitAny = scene_intersect(ray, t, id);
+    STAT(count_closest(depth, hitAny));
+    return shade(ray, hitAny, t, id, depth, aov);
+}
+
+using Clock = std::chrono::steady_clock;
+inline double ms_since(Clock::time_point t0){
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// pinhole camera looking down -z
+struct Camera {
+    Vec pos;
+    double fov;
+    int width, height;
+    Camera(const Vec& p, double f, int w, int h) : pos(p), fov(f), width(w), height(h) {}
+    // ray through image position (px,py), measured in pixels from the top-left corner
+    Ray primary(double px, double py) const {
+        double x = (2 * px / (double)width  - 1) * tan(fov/2.0) * (width / (double)height);
+        double y = (1 - 2 * py / (double)height) * tan(fov/2.0);
+        return Ray(pos, normalize(Vec(x, y, -1)));
+    }
+};
+
+// linear HDR radiance, 3 floats per pixel, top row first; tone mapping and
+// quantisation happen afterwards in a separate output stage. The AOV arrays
+// (3 floats per pixel for normal and albedo, 1 for depth) are only filled
+// after enable_aovs(), for the denoiser.
+struct Framebuffer {
+    int width, height;
+    std::vector<float> rgb;
+    std::vector<float> normal, albedo, depth;
+    Framebuffer(int w, int h) : width(w), height(h), rgb((size_t)w * h * 3) {}
+    void enable_aovs() {
+        normal.assign(rgb.size(), 0); albedo.assign(rgb.size(), 0); depth.assign(rgb.size() / 3, MISS_DEPTH);
+    }
+    bool has_aovs() const { return !depth.empty(); }
+};
+
+inline void store_pixel(int i, int j, const Vec& color, Framebuffer& fb) {
+    size_t idx = ((size_t)j*fb.width + i) * 3;
+    fb.rgb[idx+0] = (float)color.x;
+    fb.rgb[idx+1] = (float)color.y;
+    fb.rgb[idx+2] = (float)color.z;
+}
+
+inline void store_aov(int i, int j, const AOV& a, Framebuffer& fb) {
+    size_t p = (size_t)j*fb.width + i;
+    fb.normal[3*p] = (float)a.normal.x; fb.normal[3*p+1] = (float)a.normal.y; fb.normal[3*p+2] = (float)a.normal.z;
+    fb.albedo[3*p] = (float)a.albedo.x; fb.albedo[3*p+1] = (float)a.albedo.y; fb.albedo[3*p+2] = (float)a.albedo.z;
+    fb.depth[p] = (float)a.depth;
+}
+
+inline void render_pixel(const Camera& cam, int i, int j, Framebuffer& fb) {
+    AOV a;
+    store_pixel(i, j, trace(cam.primary(i + 0.5, j + 0.5), 0, fb.has_aovs() ? &a : nullptr), fb);
+    if (fb.has_aovs()) store_aov(i, j, a, fb);
+}
+
+// pixels [i0,i1) of row j; primary rays go through the BVH as SIMD_W-ray packets
+void render_span(const Camera& cam, int j, int i0, int i1, Framebuffer& fb) {
+    if (!useSIMD || SIMD_W == 1 || !bvh.built()) {
+        for (int i = i0; i < i1; ++i) render_pixel(cam, i, j, fb);
+        return;
+    }
+    std::vector<Ray> rays;
+    rays.reserve(SIMD_W);
+    for (int i = i0; i < i1; i += SIMD_W) {
+        int n = std::min(SIMD_W, i1 - i);
+        rays.clear();
+        for (int l = 0; l < SIMD_W; ++l) rays.push_back(cam.primary(i + std::min(l, n-1) + 0.5, j + 0.5));
+        Real t[SIMD_W]; int id[SIMD_W];
+        bvh.intersect_packet(rays.data(), t, id);
+        if (scene_has_flat())
+            for (int l = 0; l < n; ++l) intersect_flat(rays[l], t[l], id[l]);
+        rayCounts.primary += n;
+        for (int l = 0; l < n; ++l) {
+            STAT(count_closest(0, id[l] != -1));
+            AOV a;
+            store_pixel(i + l, j, shade(rays[l], id[l] != -1, t[l], id[l], 0, fb.has_aovs() ? &a : nullptr), fb);
+            if (fb.has_aovs()) store_aov(i + l, j, a, fb);
+        }
+    }
+}
+
+// ---------- tiled parallel rendering ----------
+struct Tile { int x0, y0, x1, y1; };
+struct TileStat { int tile; int thread; double ms; };
+
+// per-thread tile deque: the owner pops from the back, idle threads steal from the front
+struct WorkQueue {
+    std::deque<int> q;
+    std::mutex m;
+    void push(int t) { std::lock_guard<std::mutex> lk(m); q.push_back(t); }
+    bool pop(int &t) {
+        std::lock_guard<std::mutex> lk(m);
+        if (q.empty()) return false;
+        t = q.back(); q.pop_back(); return true;
+    }
+    bool steal(int &t) {
+        std::lock_guard<std::mutex> lk(m);
+        if (q.empty()) return false;
+        t = q.front(); q.pop_front(); return true;
+    }
+};
+
+std::vector<Tile> make_tiles(int width, int height, int tileSize) {
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += tileSize)
+        for (int x = 0; x < width; x += tileSize)
+            tiles.push_back({x, y, std::min(x+tileSize, width), std::min(y+tileSize, height)});
+    return tiles;
+}
+
+// Runs fn(tileIndex, threadIndex) over all tiles on a work-stealing pool.
+// Tiles are dealt out in contiguous blocks so each thread starts on
+// neighbouring tiles; there is no shared counter so the only contention is
+// when a thread runs dry and steals.
+template <class F>
+void run_tiles(int tileCount, int threads, F fn) {
+    std::vector<WorkQueue> queues(threads);
+    for (int t = 0; t < tileCount; ++t)
+        queues[(long long)t * threads / tileCount].push(t);
+
+    auto worker = [&](int id) {
+        int t;
+        for (;;) {
+            if (queues[id].pop(t)) { fn(t, id); continue; }
+            bool stole = false;
+            for (int k = 1; k < threads && !stole; ++k)
+                stole = queues[(id + k) % threads].steal(t);
+            if (!stole) return; // every queue is empty: nothing left to do
+            fn(t, id);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int id = 1; id < threads; ++id) pool.emplace_back(worker, id);
+    worker(0);
+    for (auto &th : pool) th.join();
+}
+
+void render_parallel(const Camera& cam, Framebuffer& fb,
+                     int threads, int tileSize, std::vector<TileStat>* stats) {
+    std::vector<Tile> tiles = make_tiles(cam.width, cam.height, tileSize);
+    if (stats) stats->assign(tiles.size(), TileStat());
+    run_tiles((int)tiles.size(), threads, [&](int t, int thread) {
+        auto t0 = Clock::now();
+        const Tile &tl = tiles[t];
+        for (int j = tl.y0; j < tl.y1; ++j)
+            render_span(cam, j, tl.x0, tl.x1, fb);
+        if (stats) (*stats)[t] = {t, thread, ms_since(t0)};
+    });
+}
+
+// ---------- wavefront rendering ----------
+// Instead of recursing per pixel, every ray of one bounce level lives in a
+// contiguous buffer and each stage (intersect, shadow test, shade) runs over
+// the whole buffer before the next starts. Reflection rays are appended to the
+// next level's buffer. A ray's colour needs its reflection's colour, so the
+// per-level local colours are kept and folded back from the deepest level up.
+struct WaveLevel {
+    std::vector<Ray> rays;
+    std::vector<int> parent;      // index in the previous level (pixel index at level 0)
+    std::vector<Real> t;
+    std::vector<int> id;
+    std::vector<SurfaceHit> surf;
+    std::vector<uint64_t> shadowed; // blocked light samples, see SurfaceHit::in_shadow
+    std::vector<int> child;       // index in the next level, -1 if none
+    std::vector<Vec> color;       // final colour of this ray
+};
+
+// fn(k) for k in [0,n), in chunks on the work-stealing pool
+template <class F>
+void parallel_for(int n, int threads, F fn) {
+    const int chunk = 4096;
+    if (threads <= 1 || n <= chunk) { for (int k = 0; k < n; ++k) fn(k); return; }
+    run_tiles((n + chunk - 1) / chunk, threads, [&](int c, int) {
+        for (int k = c*chunk; k < std::min(n, (c+1)*chunk); ++k) fn(k);
+    });
+}
+
+void render_wavefront(const Camera& cam, Framebuffer& fb, int threads) {
+    std::vector<WaveLevel> levels(1);
+
+    // generate primary rays
+    WaveLevel &first = levels[0];
+    for (int j = 0; j < cam.height; ++j)
+        for (int i = 0; i < cam.width; ++i) {
+            first.rays.push_back(cam.primary(i + 0.5, j + 0.5));
+            first.parent.push_back(j*cam.width + i);
+        }
+
+    for (int depth = 0; !levels[depth].rays.empty(); ++depth) {
+        WaveLevel &L = levels[depth];
+        int n = (int)L.rays.size();
+        L.t.resize(n); L.id.resize(n); L.surf.resize(n); L.shadowed.resize(n); L.child.assign(n, -1);
+
+        if (depth == 0) rayCounts.primary += n; else rayCounts.reflection += n;
+
+        // closest hits
+        parallel_for(n, threads, [&](int k) {
+            [[maybe_unused]] bool hit = scene_intersect(L.rays[k], L.t[k], L.id[k]);
+            STAT(count_closest(depth, hit));
+        });
+
+        // hit points, normals and shadow rays
+        parallel_for(n, threads, [&](int k) {
+            if (L.id[k] >= 0) L.surf[k] = SurfaceHit(L.rays[k], L.t[k], L.id[k]);
+        });
+
+        // shadow tests
+        parallel_for(n, threads, [&](int k) {
+            if (L.id[k] >= 0) L.shadowed[k] = L.surf[k].in_shadow();
+        });
+
+        // enqueue reflection rays for the next level
+        WaveLevel next;
+        if (depth + 1 <= maxDepth) {
+            for (int k = 0; k < n; ++k) {
+                if (L.id[k] < 0 || !L.surf[k].reflective()) continue;
+                L.child[k] = (int)next.rays.size();
+                next.rays.push_back(L.surf[k].reflected(L.rays[k]));
+                next.parent.push_back(k);
+            }
+        }
+        levels.push_back(std::move(next));
+    }
+
+    // shade, deepest level first so reflected colours are ready for their parents
+    for (int depth = (int)levels.size() - 2; depth >= 0; --depth) {
+        WaveLevel &L = levels[depth];
+        const WaveLevel &below = levels[depth+1];
+        L.color.resize(L.rays.size());
+        parallel_for((int)L.rays.size(), threads, [&](int k) {
+            if (L.id[k] < 0) { L.color[k] = background(L.rays[k]); return; }
+            const SurfaceHit &s = L.surf[k];
+            Vec reflCol = L.child[k] >= 0 ? below.color[L.child[k]] : Vec(0,0,0);
+            L.color[k] = s.combine(s.local(L.rays[k], L.shadowed[k]), reflCol);
+        });
+    }
+
+    const WaveLevel &top = levels[0];
+    for (size_t k = 0; k < top.rays.size(); ++k) {
+        int p = top.parent[k];
+        store_pixel(p % cam.width, p / cam.width, top.color[k], fb);
+        if (!fb.has_aovs()) continue;
+        AOV a = {Vec(), background(top.rays[k]), MISS_DEPTH};
+        if (top.id[k] >= 0) a = {top.surf[k].N, top.surf[k].mat->color, top.t[k]};
+        store_aov(p % cam.width, p / cam.width, a, fb);
+    }
+}
+
+// ---------- adaptive supersampling ----------
+// The first pass shoots one ray through each pixel centre. Pixels whose 3x3
+// neighbourhood contrast exceeds a threshold then get more samples, a batch
+// at a time, until the samples' own spread drops below the same threshold or
+// the pixel reaches its sample limit. Flat regions stay at 1 spp, edges go
+// to the limit.
+struct AAStats { long long samples = 0; long long refined = 0; };
+
+// R2 low-discrepancy offsets inside a pixel; sample 0 is the centre
+inline void aa_offset(int k, double &dx, double &dy) {
+    const double a1 = 0.7548776662466927, a2 = 0.5698402909980532; // 1/p, 1/p^2, p the plastic number
+    dx = 0.5 + k*a1; dx -= std::floor(dx);
+    dy = 0.5 + k*a2; dy -= std::floor(dy);
+}
+
+// luminance of a colour as displayed (channels clamped to [0,1])
+inline double display_luma(double r, double g, double b) {
+    return 0.2126*std::min(1.0, r) + 0.7152*std::min(1.0, g) + 0.0722*std::min(1.0, b);
+}
+
+// display luma of the pixels in region, indexed like the framebuffer
+void aa_luma(const Framebuffer& fb, const Tile& region, std::vector<double>& luma) {
+    luma.resize((size_t)fb.width * fb.height);
+    for (int j = region.y0; j < region.y1; ++j)
+        for (int i = region.x0; i < region.x1; ++i) {
+            size_t p = (size_t)j*fb.width + i;
+            luma[p] = display_luma(fb.rgb[3*p], fb.rgb[3*p+1], fb.rgb[3*p+2]);
+        }
+}
+
+// Refines the pixels of one tile; luma must cover the tile plus a 1 pixel
+// border (clipped to the image), taken from the 1 spp render.
+void refine_tile(const Camera& cam, Framebuffer& fb, const std::vector<double>& luma, const Tile& tl,
+                 int maxSpp, double threshold, AAStats& st) {
+    const int w = fb.width, h = fb.height, batch = 4;
+    for (int j = tl.y0; j < tl.y1; ++j)
+        for (int i = tl.x0; i < tl.x1; ++i) {
+            size_t p = (size_t)j*w + i;
+            double contrast = 0;
+            for (int y = std::max(0, j-1); y <= std::min(h-1, j+1); ++y)
+                for (int x = std::max(0, i-1); x <= std::min(w-1, i+1); ++x)
+                    contrast = std::max(contrast, std::fabs(luma[(size_t)y*w + x] - luma[p]));
+            ++st.samples;
+            if (contrast <= threshold || maxSpp <= 1) continue;
+
+            ++st.refined;
+            Vec sum(fb.rgb[3*p], fb.rgb[3*p+1], fb.rgb[3*p+2]);
+            double s1 = luma[p], s2 = luma[p]*luma[p];
+            int n = 1;
+            while (n < maxSpp) {
+                for (int b = 0; b < batch && n < maxSpp; ++b, ++n) {
+                    double dx, dy;
+                    aa_offset(n, dx, dy);
+                    Vec c = trace(cam.primary(i + dx, j + dy), 0);
+                    sum += c;
+                    double l = display_luma(c.x, c.y, c.z);
+                    s1 += l; s2 += l*l;
+                }
+                double var = (s2 - s1*s1/n) / (n - 1);
+                if (std::sqrt(std::max(0.0, var)) < threshold) break;
+            }
+            st.samples += n - 1;
+            store_pixel(i, j, sum / (Real)n, fb);
+        }
+}
+
+// Refines fb, which holds a 1 spp render through pixel centres, up to maxSpp
+// samples per pixel. A negative threshold refines every pixel to maxSpp
+// (uniform supersampling).
+AAStats refine_adaptive(const Camera& cam, Framebuffer& fb, int maxSpp, double threshold, int threads, int tileSize) {
+    std::vector<double> luma;
+    aa_luma(fb, Tile{0, 0, fb.width, fb.height}, luma);
+
+    std::vector<Tile> tiles = make_tiles(fb.width, fb.height, tileSize);
+    std::vector<AAStats> perThread(threads);
+    run_tiles((int)tiles.size(), threads, [&](int t, int thread) {
+        refine_tile(cam, fb, luma, tiles[t], maxSpp, threshold, perThread[thread]);
+    });
+    AAStats total;
+    for (const AAStats &st : perThread) { total.samples += st.samples; total.refined += st.refined; }
+    return total;
+}
+
+// ---------- denoiser ----------
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) for low-sample
+// previews. Each pass blurs with the 5x5 B3-spline kernel, its taps spread
+// 2^pass pixels apart, and scales every tap by how much the neighbour's
+// colour, normal, depth and albedo differ from the centre's, so edges and
+// texture survive while shadow and sampling noise is averaged away. The
+// filter works on irradiance (colour divided by albedo) and multiplies the
+// albedo back at the end. Every pass is one read-only sweep over SoA planes:
+// row bands are spread over the thread pool and each tap is a contiguous
+// loop along the row, SIMD_W pixels at a time.
+struct DenoiseParams {
+    int passes = 4;
+    Real sigmaColor = 4;    // irradiance distance, halved every pass
+    Real sigmaNormal = 0.3; // length of the normal difference
+    Real sigmaDepth = 0.05; // depth difference relative to the centre depth
+    Real sigmaAlbedo = 0.1;
+};
+
+// exp(-x) for x >= 0 as (1 - x/64)^64: no branches or libm calls, so it
+// runs on SIMD lanes, and close enough for filter weights. x is capped at 32
+// so the result never goes denormal (~5e-20 instead of exp(-32) ~ 1e-14).
+inline Real exp_neg_approx(Real x) {
+    Real y = 1 - std::min(x, Real(32)) * Real(1.0/64);
+    for (int k = 0; k < 6; ++k) y *= y;
+    return y;
+}
+inline VR exp_neg_approx(VR x) {
+    VR y = VR(1) - vmin(x, VR(32)) * VR(1.0/64);
+    for (int k = 0; k < 6; ++k) y = y * y;
+    return y;
+}
+
+// a-trous filter state: planes of the guide buffers and two irradiance
+// buffers that passes alternate between
+struct DenoisePlanes {
+    std::vector<Real> irr[2][3], nrm[3], alb[3], depth, rdepth; // rdepth: 1/depth
+};
+
+// one pass over rows [j0, j1): dst = weighted average of src's 25 taps
+void atrous_rows(DenoisePlanes& P, int src, int w, int h, int j0, int j1, int step,
+                 Real invC, Real invN, Real invZ, Real invA) {
+    const Real kernel[5] = {1.0/16, 1.0/4, 3.0/8, 1.0/4, 1.0/16};
+    const std::vector<Real> (&in)[3] = P.irr[src];
+    std::vector<Real> (&out)[3] = P.irr[src ^ 1];
+    std::vector<Real> wsum(w), sr(w), sg(w), sb(w);
+    for (int j = j0; j < j1; ++j) {
+        const size_t row = (size_t)j * w;
+        std::fill(wsum.begin(), wsum.end(), Real(0));
+        std::fill(sr.begin(), sr.end(), Real(0));
+        std::fill(sg.begin(), sg.end(), Real(0));
+        std::fill(sb.begin(), sb.end(), Real(0));
+        for (int ty = 0; ty < 5; ++ty) {
+            int y = j + (ty - 2) * step;
+            if (y < 0 || y >= h) continue; // taps outside the image are dropped, weights renormalise
+            for (int tx = 0; tx < 5; ++tx) {
+                const int off = (tx - 2) * step;
+                const int i0 = std::max(0, -off), n = std::min(w, w - off) - i0;
+                if (n <= 0) continue;
+                // c*: centre pixels row[i0, i0+n), q*: their neighbours at (i + off, y)
+                const size_t c = row + i0, q = (size_t)y * w + i0 + off;
+                const Real *cr = &in[0][c], *cg = &in[1][c], *cb = &in[2][c];
+                const Real *cnx = &P.nrm[0][c], *cny = &P.nrm[1][c], *cnz = &P.nrm[2][c];
+                const Real *cax = &P.alb[0][c], *cay = &P.alb[1][c], *caz = &P.alb[2][c];
+                const Real *cz = &P.depth[c], *crz = &P.rdepth[c];
+                const Real *qr = &in[0][q], *qg = &in[1][q], *qb = &in[2][q];
+                const Real *qnx = &P.nrm[0][q], *qny = &P.nrm[1][q], *qnz = &P.nrm[2][q];
+                const Real *qax = &P.alb[0][q], *qay = &P.alb[1][q], *qaz = &P.alb[2][q], *qz = &P.depth[q];
+                Real *ws = &wsum[i0], *ar = &sr[i0], *ag = &sg[i0], *ab = &sb[i0];
+                const Real k = kernel[ty] * kernel[tx];
+                int i = 0;
+                for (; i + SIMD_W <= n; i += SIMD_W) {
+                    VR dr = vloadu(cr+i) - vloadu(qr+i), dg = vloadu(cg+i) - vloadu(qg+i), db = vloadu(cb+i) - vloadu(qb+i);
+                    VR dnx = vloadu(cnx+i) - vloadu(qnx+i), dny = vloadu(cny+i) - vloadu(qny+i), dnz = vloadu(cnz+i) - vloadu(qnz+i);
+                    VR dax = vloadu(cax+i) - vloadu(qax+i), day = vloadu(cay+i) - vloadu(qay+i), daz = vloadu(caz+i) - vloadu(qaz+i);
+                    VR dz = vloadu(cz+i) - vloadu(qz+i);
+                    dz = vmax(dz, VR(0) - dz) * vloadu(crz+i);
+                    VR e = (dr*dr + dg*dg + db*db) * VR(invC) + (dnx*dnx + dny*dny + dnz*dnz) * VR(invN)
+                         + dz * VR(invZ) + (dax*dax + day*day + daz*daz) * VR(invA);
+                    VR wt = VR(k) * exp_neg_approx(e);
+                    vstore(ws+i, vloadu(ws+i) + wt);
+                    vstore(ar+i, vloadu(ar+i) + wt * vloadu(qr+i));
+                    vstore(ag+i, vloadu(ag+i) + wt * vloadu(qg+i));
+                    vstore(ab+i, vloadu(ab+i) + wt * vloadu(qb+i));
+                }
+                for (; i < n; ++i) {
+                    Real dr = cr[i] - qr[i], dg = cg[i] - qg[i], db = cb[i] - qb[i];
+                    Real dnx = cnx[i] - qnx[i], dny = cny[i] - qny[i], dnz = cnz[i] - qnz[i];
+                    Real dax = cax[i] - qax[i], day = cay[i] - qay[i], daz = caz[i] - qaz[i];
+                    Real dz = std::fabs(cz[i] - qz[i]) * crz[i];
+                    Real e = (dr*dr + dg*dg + db*db) * invC + (dnx*dnx + dny*dny + dnz*dnz) * invN
+                           + dz * invZ + (dax*dax + day*day + daz*daz) * invA;
+                    Real wt = k * exp_neg_approx(e);
+                    ws[i] += wt;
+                    ar[i] += wt * qr[i]; ag[i] += wt * qg[i]; ab[i] += wt * qb[i];
+                }
+            }
+        }
+        for (int i = 0; i < w; ++i) { // the centre tap always has weight > 0
+            out[0][row + i] = sr[i] / wsum[i];
+            out[1][row + i] = sg[i] / wsum[i];
+            out[2][row + i] = sb[i] / wsum[i];
+        }
+    }
+}
+
+// Denoises fb in place using its AOVs; does nothing if they are not enabled.
+void denoise(Framebuffer& fb, int threads, const DenoiseParams& prm = DenoiseParams()) {
+    if (!fb.has_aovs()) return;
+    const int w = fb.width, h = fb.height, band = 8;
+    const size_t n = (size_t)w * h;
+    const Real eps = 1e-3;
+
+    DenoisePlanes P;
+    P.depth.assign(fb.depth.begin(), fb.depth.end());
+    P.rdepth.resize(n);
+    for (size_t p = 0; p < n; ++p) P.rdepth[p] = 1 / (P.depth[p] + eps);
+    for (int c = 0; c < 3; ++c) {
+        P.irr[0][c].resize(n); P.irr[1][c].resize(n); P.nrm[c].resize(n); P.alb[c].resize(n);
+        for (size_t p = 0; p < n; ++p) {
+            P.nrm[c][p] = fb.normal[3*p+c];
+            P.alb[c][p] = fb.albedo[3*p+c];
+            P.irr[0][c][p] = fb.rgb[3*p+c] / (P.alb[c][p] + eps);
+        }
+    }
+
+    for (int pass = 0; pass < prm.passes; ++pass) {
+        const int step = 1 << pass;
+        const Real sc = prm.sigmaColor / step;
+        run_tiles((h + band - 1) / band, threads, [&](int b, int) {
+            atrous_rows(P, pass & 1, w, h, b*band, std::min(h, (b+1)*band), step, 1 / (sc*sc),
+                        1 / (prm.sigmaNormal*prm.sigmaNormal), 1 / prm.sigmaDepth, 1 / (prm.sigmaAlbedo*prm.sigmaAlbedo));
+        });
+    }
+
+    const std::vector<Real> (&out)[3] = P.irr[prm.passes & 1];
+    for (int c = 0; c < 3; ++c)
+        for (size_t p = 0; p < n; ++p)
+            fb.rgb[3*p+c] = (float)(out[c][p] * (P.alb[c][p] + eps));
+}
+
+// ---------- distributed rendering ----------
+// Coordinator/worker mode. The coordinator forks N worker processes, each on
+// its own Unix socket pair, and hands out one tile at a time. A worker renders
+// the tile, runs the adaptive AA on it (rendering a 1 pixel border at 1 spp
+// too, so the contrast test sees the same neighbours as a whole-frame pass),
+// and sends back the tile's linear floats plus AOVs if the coordinator wants
+// them. The coordinator assembles the framebuffer; tone mapping and the
+// denoiser then run on exactly the data a single-process render produces.
+// A worker whose socket closes (crash, kill) has its tile put back in the
+// queue. Once the queue is empty, idle workers also take copies of tiles that
+// have been out for more than SLOW_FACTOR times the mean tile time; the first
+// copy back wins. Rendering is deterministic, so the result is the same
+// whichever copy arrives. Tiles left when every worker is gone are rendered
+// by the coordinator itself.
+struct TileRequest { int32_t tile, x0, y0, x1, y1, maxSpp, aovs; double threshold; }; // tile < 0: exit
+struct TileReply { int32_t tile, floats; int64_t samples, refined; };
+struct DistStats { int tiles = 0, failed = 0, slow = 0, duplicates = 0, local = 0; AAStats aa; };
+const double SLOW_FACTOR = 4;
+
+bool read_full(int fd, void* buf, size_t n) {
+    char *p = static_cast<char*>(buf);
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r; n -= r;
+    }
+    return true;
+}
+
+bool write_full(int fd, const void* buf, size_t n) {
+    const char *p = static_cast<const char*>(buf);
+    while (n > 0) {
+        ssize_t r = write(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r; n -= r;
+    }
+    return true;
+}
+
+// floats per pixel on the wire: colour, then normal, albedo, depth if asked
+inline int tile_floats(bool aovs) { return aovs ? 10 : 3; }
+
+void pack_tile(const Framebuffer& fb, const Tile& tl, bool aovs, std::vector<float>& out) {
+    out.clear();
+    for (int j = tl.y0; j < tl.y1; ++j) {
+        size_t p0 = (size_t)j*fb.width + tl.x0, p1 = (size_t)j*fb.width + tl.x1;
+        out.insert(out.end(), fb.rgb.begin() + 3*p0, fb.rgb.begin() + 3*p1);
+        if (!aovs) continue;
+        out.insert(out.end(), fb.normal.begin() + 3*p0, fb.normal.begin() + 3*p1);
+        out.insert(out.end(), fb.albedo.begin() + 3*p0, fb.albedo.begin() + 3*p1);
+        out.insert(out.end(), fb.depth.begin() + p0, fb.depth.begin() + p1);
+    }
+}
+
+void unpack_tile(Framebuffer& fb, const Tile& tl, const float* in) {
+    const size_t n = tl.x1 - tl.x0;
+    for (int j = tl.y0; j < tl.y1; ++j) {
+        size_t p0 = (size_t)j*fb.width + tl.x0;
+        std::copy(in, in + 3*n, fb.rgb.begin() + 3*p0); in += 3*n;
+        if (!fb.has_aovs()) continue;
+        std::copy(in, in + 3*n, fb.normal.begin() + 3*p0); in += 3*n;
+        std::copy(in, in + 3*n, fb.albedo.begin() + 3*p0); in += 3*n;
+        std::copy(in, in + n, fb.depth.begin() + p0); in += n;
+    }
+}
+
+// renders one tile (and its AA border) into the scratch framebuffer fb
+AAStats render_tile_job(const Camera& cam, Framebuffer& fb, const Tile& tl, int maxSpp, double threshold) {
+    AAStats st;
+    Tile r = tl;
+    if (maxSpp > 1) r = {std::max(0, tl.x0-1), std::max(0, tl.y0-1), std::min(fb.width, tl.x1+1), std::min(fb.height, tl.y1+1)};
+    for (int j = r.y0; j < r.y1; ++j)
+        render_span(cam, j, r.x0, r.x1, fb);
+    if (maxSpp > 1) {
+        std::vector<double> luma;
+        aa_luma(fb, r, luma);
+        refine_tile(cam, fb, luma, tl, maxSpp, threshold, st);
+    }
+    return st;
+}
+
+// Worker side: serve tile requests until told to stop or the coordinator
+// goes away. fault injects failures for testing: 1 crashes on the third
+// tile, 2 stalls 200 ms before answering each tile.
+void worker_loop(int fd, const Camera& cam, int fault) {
+    Framebuffer fb(cam.width, cam.height);
+    std::vector<float> payload;
+    TileRequest rq;
+    for (int served = 0; read_full(fd, &rq, sizeof rq) && rq.tile >= 0; ++served) {
+        if (rq.aovs && !fb.has_aovs()) fb.enable_aovs();
+        if (fault == 1 && served == 2) _exit(3);
+        Tile tl = {rq.x0, rq.y0, rq.x1, rq.y1};
+        AAStats st = render_tile_job(cam, fb, tl, rq.maxSpp, rq.threshold);
+        pack_tile(fb, tl, rq.aovs != 0, payload);
+        if (fault == 2) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        TileReply rp = {rq.tile, (int32_t)payload.size(), st.samples, st.refined};
+        if (!write_full(fd, &rp, sizeof rp) || !write_full(fd, payload.data(), payload.size() * sizeof(float))) break;
+    }
+}
+
+// Coordinator side. faults: worker 0 crashes and worker 1 is slow (see worker_loop).
+DistStats render_distributed(const Camera& cam, Framebuffer& fb, int workers, int tileSize,
+                             int maxSpp, double threshold, bool faults) {
+    struct Worker { pid_t pid; int fd; int tile; Clock::time_point start; };
+    const std::vector<Tile> tiles = make_tiles(cam.width, cam.height, tileSize);
+    const int n = (int)tiles.size();
+    const bool aovs = fb.has_aovs();
+    DistStats ds;
+    ds.tiles = n;
+    signal(SIGPIPE, SIG_IGN); // a dead peer is a write error, not a dead coordinator
+
+    std::cout.flush(); // or the children would print it again
+    std::vector<Worker> pool;
+    for (int k = 0; k < workers; ++k) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) { perror("socketpair"); break; }
+        pid_t pid = fork();
+        if (pid < 0) { perror("fork"); close(sv[0]); close(sv[1]); break; }
+        if (pid == 0) {
+            close(sv[0]);
+            for (const Worker &w : pool) close(w.fd);
+            worker_loop(sv[1], cam, !faults ? 0 : k == 0 ? 1 : k == 1 ? 2 : 0);
+            _exit(0);
+        }
+        close(sv[1]);
+        pool.push_back({pid, sv[0], -1, Clock::now()});
+    }
+
+    std::deque<int> pending;
+    for (int t = 0; t < n; ++t) pending.push_back(t);
+    std::vector<char> done(n, 0);
+    std::vector<int> copies(n, 0); // workers currently rendering each tile
+    std::vector<float> payload;
+    double tileMs = 0; int timed = 0;
+    int remaining = n;
+
+    auto retire = [&](Worker& w) { // worker gone: its tile goes back to the queue
+        close(w.fd); w.fd = -1;
+        waitpid(w.pid, nullptr, 0);
+        ++ds.failed;
+        if (w.tile >= 0 && !done[w.tile] && --copies[w.tile] == 0) pending.push_front(w.tile);
+        w.tile = -1;
+    };
+
+    while (remaining > 0) {
+        bool anyAlive = false;
+        for (Worker &w : pool) {
+            if (w.fd < 0) continue;
+            anyAlive = true;
+            if (w.tile >= 0) continue;
+            int t = -1;
+            while (!pending.empty() && t < 0) {
+                t = pending.front(); pending.pop_front();
+                if (done[t]) t = -1;
+            }
+            if (t < 0 && timed > 0) { // speculative copy of the oldest straggler
+                double oldest = SLOW_FACTOR * tileMs / timed;
+                for (const Worker &o : pool)
+                    if (o.fd >= 0 && o.tile >= 0 && copies[o.tile] == 1 && ms_since(o.start) > oldest) {
+                        oldest = ms_since(o.start); t = o.tile;
+                    }
+                if (t >= 0) ++ds.slow;
+            }
+            if (t < 0) continue;
+            const Tile &tl = tiles[t];
+            TileRequest rq = {t, tl.x0, tl.y0, tl.x1, tl.y1, maxSpp, aovs, threshold};
+            w.tile = t; w.start = Clock::now(); ++copies[t];
+            if (!write_full(w.fd, &rq, sizeof rq)) retire(w);
+        }
+        if (!anyAlive) break;
+
+        std::vector<pollfd> fds;
+        std::vector<Worker*> who;
+        for (Worker &w : pool)
+            if (w.fd >= 0 && w.tile >= 0) { fds.push_back({w.fd, POLLIN, 0}); who.push_back(&w); }
+        if (fds.empty()) continue;
+        if (poll(fds.data(), fds.size(), 20) < 0 && errno != EINTR) { perror("poll"); break; }
+        for (size_t k = 0; k < fds.size(); ++k) {
+            if (!fds[k].revents) continue;
+            Worker &w = *who[k];
+            TileReply rp;
+            if (!read_full(w.fd, &rp, sizeof rp) || rp.tile != w.tile ||
+                rp.floats != (tiles[rp.tile].x1 - tiles[rp.tile].x0) * (tiles[rp.tile].y1 - tiles[rp.tile].y0) * tile_floats(aovs)) {
+                retire(w); continue;
+            }
+            payload.resize(rp.floats);
+            if (!read_full(w.fd, payload.data(), payload.size() * sizeof(float))) { retire(w); continue; }
+            --copies[rp.tile];
+            w.tile = -1;
+            if (done[rp.tile]) { ++ds.duplicates; continue; }
+            unpack_tile(fb, tiles[rp.tile], payload.data());
+            done[rp.tile] = 1; --remaining;
+            ds.aa.samples += rp.samples; ds.aa.refined += rp.refined;
+            tileMs += ms_since(w.start); ++timed;
+        }
+    }
+
+    // stop the pool: idle workers are told to exit, busy ones (stragglers) killed
+    for (Worker &w : pool) {
+        if (w.fd < 0) continue;
+        TileRequest quit = {-1, 0, 0, 0, 0, 0, 0, 0};
+        if (w.tile >= 0 || !write_full(w.fd, &quit, sizeof quit)) kill(w.pid, SIGKILL);
+        close(w.fd);
+        waitpid(w.pid, nullptr, 0);
+    }
+
+    // whatever no worker delivered
+    if (remaining > 0) {
+        Framebuffer scratch(fb.width, fb.height);
+        if (aovs) scratch.enable_aovs();
+        for (int t = 0; t < n; ++t) {
+            if (done[t]) continue;
+            AAStats st = render_tile_job(cam, scratch, tiles[t], maxSpp, threshold);
+            pack_tile(scratch, tiles[t], aovs, payload);
+            unpack_tile(fb, tiles[t], payload.data());
+            ds.aa.samples += st.samples; ds.aa.refined += st.refined;
+            ++ds.local;
+        }
+    }
+    return ds;
+}
+
+// ---------- checkpointing ----------
+// Long renders can log finished tiles to a checkpoint file so a crash or
+// preemption only loses the tiles in flight. The file is a header (image
+// and sampling settings plus a fingerprint of the scene) followed by one
+// record per tile: a TileReply and the tile's floats, as on the worker
+// socket. Tiles are rendered as independent jobs (render_tile_job, like the
+// distributed workers), so a tile's data never depends on which others were
+// rendered in the same run. Records are appended by a writer thread every
+// few seconds, so render threads only copy their tile into a queue. On
+// --resume the complete records are loaded, a torn last record is cut off,
+// and only the missing tiles are rendered.
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t fingerprint;
+    int32_t width, height, tileSize, maxSpp, aovs, pad;
+    double threshold;
+};
+const uint32_t CHECKPOINT_VERSION = 2;
+
+// hash of everything besides the camera and sampling settings that changes
+// the image: every primitive's geometry and material, every light field and
+// the shading limits
+uint64_t scene_fingerprint() {
+    uint64_t h = mix64(scene_size());
+    auto add = [&](Real v) { uint64_t b = 0; std::memcpy(&b, &v, sizeof(Real)); h = mix64(h ^ b); };
+    auto addVec = [&](const Vec& v) { add(v.x); add(v.y); add(v.z); };
+    auto addMat = [&](const Material& m) { addVec(m.color); add(m.reflect); };
+    for (int i = 0; i < scene_size(); ++i) {
+        addVec(sphere_center(i)); add(sphere_radius(i)); addMat(sphere_material(i));
+    }
+    h = mix64(h ^ planes.size());
+    for (const Plane &pl : planes) { addVec(pl.n); add(pl.d); addMat(pl.m); }
+    h = mix64(h ^ triangles.size());
+    for (const Triangle &t : triangles) { addVec(t.a); addVec(t.b); addVec(t.c); addMat(t.m); }
+    h = mix64(h ^ meshes.size());
+    for (const Mesh &m : meshes) {
+        h = mix64(h ^ m.verts.size());
+        for (const Vec &v : m.verts) addVec(v);
+        h = mix64(h ^ m.index.size());
+        for (int i : m.index) h = mix64(h ^ (uint32_t)i);
+        addMat(m.m);
+    }
+    h = mix64(h ^ lights.size());
+    for (const Light &l : lights) {
+        h = mix64(h ^ ((uint64_t)l.kind << 1 | (uint64_t)l.falloff));
+        addVec(l.pos); addVec(l.dir); add(l.radius); addVec(l.color);
+    }
+    return mix64(h ^ ((uint64_t)maxDepth << 32 | (uint64_t)lightSamples));
+}
+
+// appends queued tile records to the checkpoint file from its own thread
+struct CheckpointWriter {
+    int fd;
+    double intervalMs;
+    std::vector<char> queued;
+    std::mutex m;
+    std::condition_variable cv;
+    bool stop = false, failed = false;
+    long long bytes = 0; int flushes = 0; double busyMs = 0;
+    std::thread worker;
+
+    CheckpointWriter(int fd_, double intervalMs_) : fd(fd_), intervalMs(intervalMs_) {
+        worker = std::thread([this] { run(); });
+    }
+    void add(const TileReply& rec, const std::vector<float>& data) {
+        std::lock_guard<std::mutex> lk(m);
+        const char *r = reinterpret_cast<const char*>(&rec), *d = reinterpret_cast<const char*>(data.data());
+        queued.insert(queued.end(), r, r + sizeof rec);
+        queued.insert(queued.end(), d, d + data.size() * sizeof(float));
+    }
+    void run() {
+        std::vector<char> batch;
+        std::unique_lock<std::mutex> lk(m);
+        for (bool last = false; !last; ) {
+            cv.wait_for(lk, std::chrono::duration<double, std::milli>(intervalMs), [this] { return stop; });
+            last = stop;
+            batch.swap(queued);
+            lk.unlock();
+            if (!batch.empty()) {
+                auto t0 = Clock::now();
+                if (!write_full(fd, batch.data(), batch.size()) || fdatasync(fd) != 0) failed = true;
+                busyMs += ms_since(t0);
+                bytes += batch.size(); ++flushes;
+                batch.clear();
+            }
+            lk.lock();
+        }
+    }
+    // writes whatever is still queued and stops the thread
+    void finish() {
+        { std::lock_guard<std::mutex> lk(m); stop = true; }
+        cv.notify_all();
+        worker.join();
+    }
+};
+
+struct CheckpointStats { int tiles = 0, resumed = 0, flushes = 0; long long bytes = 0; double writerMs = 0; AAStats aa; };
+
+// Tiled render that logs finished tiles to path. With resume, the tiles
+// already in a matching checkpoint are loaded instead of rendered; a
+// missing file starts a new one. Returns false on I/O errors or a
+// checkpoint made with other settings.
+bool render_checkpointed(const Camera& cam, Framebuffer& fb, int threads, int tileSize, int maxSpp, double threshold,
+                         const std::string& path, bool resume, double intervalMs, CheckpointStats& cs) {
+    const std::vector<Tile> tiles = make_tiles(cam.width, cam.height, tileSize);
+    const bool aovs = fb.has_aovs();
+    CheckpointHeader want = {{'L','8','C','K'}, CHECKPOINT_VERSION, scene_fingerprint(),
+                             cam.width, cam.height, tileSize, maxSpp, aovs, 0, maxSpp > 1 ? threshold : 0};
+    std::vector<char> done(tiles.size(), 0);
+    cs.tiles = (int)tiles.size();
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+    if (fd < 0) { perror(path.c_str()); return false; }
+    CheckpointHeader have;
+    off_t end = 0;
+    if (resume && read_full(fd, &have, sizeof have)) {
+        if (std::memcmp(&have, &want, sizeof have) != 0) {
+            std::cerr << path << ": checkpoint is for a different scene or settings\n";
+            close(fd); return false;
+        }
+        end = sizeof have;
+        TileReply rec;
+        std::vector<float> data;
+        while (read_full(fd, &rec, sizeof rec) && rec.tile >= 0 && rec.tile < (int)tiles.size()) {
+            const Tile &tl = tiles[rec.tile];
+            if (rec.floats != (tl.x1 - tl.x0) * (tl.y1 - tl.y0) * tile_floats(aovs)) break;
+            data.resize(rec.floats);
+            if (!read_full(fd, data.data(), data.size() * sizeof(float))) break;
+            unpack_tile(fb, tl, data.data());
+            if (!done[rec.tile]) { ++cs.resumed; cs.aa.samples += rec.samples; cs.aa.refined += rec.refined; }
+            done[rec.tile] = 1;
+            end = lseek(fd, 0, SEEK_CUR);
+        }
+    }
+    if (end == 0) { // new file (or an empty one)
+        if (ftruncate(fd, 0) != 0 || !write_full(fd, &want, sizeof want)) { perror(path.c_str()); close(fd); return false; }
+        end = sizeof want;
+    }
+    if (ftruncate(fd, end) != 0 || lseek(fd, end, SEEK_SET) != end) { perror(path.c_str()); close(fd); return false; }
+
+    std::vector<int> todo;
+    for (int t = 0; t < (int)tiles.size(); ++t) if (!done[t]) todo.push_back(t);
+    std::vector<std::unique_ptr<Framebuffer>> scratch(threads);
+    std::vector<AAStats> perThread(threads);
+    CheckpointWriter writer(fd, intervalMs);
+    run_tiles((int)todo.size(), threads, [&](int k, int thread) {
+        thread_local std::vector<float> data;
+        const Tile &tl = tiles[todo[k]];
+        Framebuffer *target = &fb; // AA renders a border around the tile, which must not land in fb
+        if (maxSpp > 1) {
+            if (!scratch[thread]) {
+                scratch[thread].reset(new Framebuffer(fb.width, fb.height));
+                if (aovs) scratch[thread]->enable_aovs();
+            }
+            target = scratch[thread].get();
+        }
+        AAStats st = render_tile_job(cam, *target, tl, maxSpp, threshold);
+        pack_tile(*target, tl, aovs, data);
+        if (target != &fb) unpack_tile(fb, tl, data.data());
+        writer.add(TileReply{todo[k], (int32_t)data.size(), st.samples, st.refined}, data);
+        perThread[thread].samples += st.samples; perThread[thread].refined += st.refined;
+    });
+    writer.finish();
+    close(fd);
+    for (const AAStats &st : perThread) { cs.aa.samples += st.samples; cs.aa.refined += st.refined; }
+    cs.flushes = writer.flushes; cs.bytes = writer.bytes; cs.writerMs = writer.busyMs;
+    if (writer.failed) { std::cerr << path << ": checkpoint write failed\n"; return false; }
+    return true;
+}
+
+// ---------- output stage: tone mapping, gamma, quantisation ----------
+enum ToneOp { TONE_CLAMP, TONE_REINHARD, TONE_ACES };
+
+inline double tone_curve(ToneOp op, double x) {
+    x = x > 0 ? x : 0; // also maps NaN to black
+    switch (op) {
+    case TONE_REINHARD: return x / (1 + x);
+    case TONE_ACES:     return std::min(1.0, x*(2.51*x + 0.03) / (x*(2.43*x + 0.59) + 0.14)); // Narkowicz fit
+    default:            return std::min(1.0, x);
+    }
+}
+
+// tone curve, gamma 2.2 and rounding to 8 bits, done the slow way
+inline unsigned char encode_exact(ToneOp op, double x) {
+    return (unsigned char)std::round(std::pow(tone_curve(op, x), 1.0/2.2) * 255.0);
+}
+
+// Tone curve + gamma + quantisation folded into one table. Buckets are taken
+// from the top bits of the float (exponent and MANT_BITS of mantissa), so they
+// are narrow near black where the gamma curve is steep. Each bucket keeps its
+// code and the input at which the code steps up by one; lookups are exact as
+// long as no bucket spans more than one step, which build() reports.
+struct ToneLUT {
+    static const int MANT_BITS = 8;
+    static const int MIN_EXP = -24, MAX_EXP = 16; // below 2^-24 every curve rounds to 0
+    ToneOp op = TONE_CLAMP;
+    std::vector<unsigned char> code;
+    std::vector<float> next;
+
+    static uint32_t bits(float x) { uint32_t b; std::memcpy(&b, &x, 4); return b; }
+    static float from_bits(uint32_t b) { float x; std::memcpy(&x, &b, 4); return x; }
+    static uint32_t base() { return bits(std::ldexp(1.0f, MIN_EXP)) >> (23 - MANT_BITS); }
+
+    // returns the number of buckets that span more than one code (0 = exact)
+    int build(ToneOp o) {
+        op = o;
+        size_t n = (size_t)(MAX_EXP - MIN_EXP) << MANT_BITS;
+        code.resize(n); next.resize(n);
+        int wide = 0;
+        for (size_t b = 0; b < n; ++b) {
+            uint32_t lo = (uint32_t)(base() + b) << (23 - MANT_BITS), hi = lo + (1u << (23 - MANT_BITS)) - 1;
+            code[b] = encode_exact(op, from_bits(lo));
+            if (encode_exact(op, from_bits(hi)) == code[b]) { next[b] = INFINITY; continue; }
+            while (lo < hi) { // first input whose code is past code[b]
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (encode_exact(op, from_bits(mid)) > code[b]) hi = mid; else lo = mid + 1;
+            }
+            next[b] = from_bits(lo);
+            if (encode_exact(op, from_bits(lo | ((1u << (23 - MANT_BITS)) - 1))) > code[b] + 1) ++wide;
+        }
+        return wide;
+    }
+    unsigned char operator()(float x) const {
+        const float lo = std::ldexp(1.0f, MIN_EXP), hi = std::nextafter(std::ldexp(1.0f, MAX_EXP), 0.0f);
+        x = x > lo ? (x < hi ? x : hi) : lo;
+        size_t b = (bits(x) >> (23 - MANT_BITS)) - base();
+        return code[b] + (x >= next[b]);
+    }
+};
+
+// 8-bit sRGB-ish image from the HDR framebuffer, in parallel chunks
+void tonemap(const Framebuffer& fb, const ToneLUT& lut, std::vector<unsigned char>& img, int threads) {
+    img.resize(fb.rgb.size());
+    parallel_for((int)fb.rgb.size(), threads, [&](int k) { img[k] = lut(fb.rgb[k]); });
+}
+
+bool write_ppm(const std::string& path, int width, int height, const std::vector<unsigned char>& img) {
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << "P6\n" << width << " " << height << "\n255\n";
+    ofs.write(reinterpret_cast<const char*>(img.data()), img.size());
+    if (!ofs) { std::cerr << "cannot write " << path << "\n"; return false; }
+    return true;
+}
+
+// linear radiance as a little-endian PFM (rows stored bottom to top)
+bool write_pfm(const std::string& path, const Framebuffer& fb) {
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << "PF\n" << fb.width << " " << fb.height << "\n-1.0\n";
+    for (int j = fb.height - 1; j >= 0; --j)
+        ofs.write(reinterpret_cast<const char*>(&fb.rgb[(size_t)j * fb.width * 3]), fb.width * 3 * sizeof(float));
+    if (!ofs) { std::cerr << "cannot write " << path << "\n"; return false; }
+    return true;
+}
+
+// ---------- animation ----------
+// Renders a sequence of frames from an animation script. The camera position
+// and sphere centres are keyframed and interpolated linearly between keys;
+// everything else is static. Two things carry over between frames:
+//  - the sphere BVH is refit rather than rebuilt when at most REFIT_FRACTION
+//    of the spheres moved;
+//  - a pixel keeps last frame's colour when the camera did not move and its
+//    primary hit was a miss or a non-reflective surface, and neither the
+//    primary ray nor any of the hit's shadow rays touch a moved sphere at its
+//    old or new position. Its colour then cannot have changed: same hit,
+//    same light samples (they are hashed from the hit point), same
+//    visibility. Every other pixel is traced in full.
+// Script lines: "frames N", "camera F x y z", "sphere I F x y z" (sphere I
+// is at x y z at frame F); '#' starts a comment.
+struct Keyframe { int frame; Vec v; };
+struct Animation {
+    int frames = 1;
+    std::vector<Keyframe> camera;
+    std::map<int, std::vector<Keyframe>> spheres;
+};
+const double REFIT_FRACTION = 0.1;
+
+bool load_animation(const std::string& path, Animation& anim) {
+    std::ifstream in(path);
+    if (!in) { std::cerr << "cannot open " << path << "\n"; return false; }
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ls(line);
+        std::string kind;
+        if (!(ls >> kind)) continue;
+        int f, i; double x, y, z;
+        if (kind == "frames" && ls >> anim.frames && anim.frames > 0) continue;
+        if (kind == "camera" && ls >> f >> x >> y >> z) { anim.camera.push_back({f, Vec(x, y, z)}); continue; }
+        if (kind == "sphere" && ls >> i >> f >> x >> y >> z && i >= 0 && i < (int)spheres.size()) {
+            anim.spheres[i].push_back({f, Vec(x, y, z)}); continue;
+        }
+        std::cerr << path << ":" << lineNo << ": cannot parse '" << line << "'\n";
+        return false;
+    }
+    auto byFrame = [](const Keyframe& a, const Keyframe& b) { return a.frame < b.frame; };
+    std::stable_sort(anim.camera.begin(), anim.camera.end(), byFrame);
+    for (auto &tr : anim.spheres) std::stable_sort(tr.second.begin(), tr.second.end(), byFrame);
+    return true;
+}
+
+// value of a keyframe track at frame f (held before the first and after the last key)
+Vec sample_track(const std::vector<Keyframe>& tr, int f) {
+    if (f <= tr.front().frame) return tr.front().v;
+    for (size_t k = 1; k < tr.size(); ++k)
+        if (f <= tr[k].frame) {
+            Real u = Real(f - tr[k-1].frame) / (tr[k].frame - tr[k-1].frame);
+            return tr[k-1].v + (tr[k].v - tr[k-1].v) * u;
+        }
+    return tr.back().v;
+}
+
+struct FrameStats { int moved = 0; const char* bvhAction = "kept"; double bvhMs = 0, renderMs = 0; long long reused = 0; };
+
+// Renders frame f of anim into fb. prev (camera position and sphere centres
+// of the frame in fb, with its per-pixel primary hits in hitId/hitT) enables
+// reuse; incremental = false rebuilds and retraces everything (the baseline).
+FrameStats render_frame(const Animation& anim, int f, Camera& cam, Framebuffer& fb, std::vector<int>& hitId,
+                        std::vector<Real>& hitT, bool haveprev, bool incremental, int threads, int tileSize) {
+    FrameStats fs;
+    Vec camPos = anim.camera.empty() ? cam.pos : sample_track(anim.camera, f);
+    bool camMoved = !haveprev || !(camPos.x == cam.pos.x && camPos.y == cam.pos.y && camPos.z == cam.pos.z);
+    cam.pos = camPos;
+    struct Move { int i; Vec from, to; };
+    std::vector<Move> moved;
+    for (const auto &tr : anim.spheres) {
+        Sphere &sp = spheres[tr.first];
+        Vec c = sample_track(tr.second, f);
+        if (c.x == sp.c.x && c.y == sp.c.y && c.z == sp.c.z) continue;
+        moved.push_back({tr.first, sp.c, c});
+        sp.c = c;
+    }
+    fs.moved = (int)moved.size();
+
+    auto t0 = Clock::now();
+    if (!incremental || !bvh.built()) { bvh.build(spheres); fs.bvhAction = "build"; }
+    else if (!moved.empty()) {
+        bool refit = moved.size() <= REFIT_FRACTION * spheres.size();
+        if (refit) bvh.refit(spheres); else bvh.build(spheres);
+        fs.bvhAction = refit ? "refit" : "build";
+    }
+    fs.bvhMs = ms_since(t0);
+
+    // Does the segment [0, tmax) of ray touch a moved sphere, before or after
+    // the move? Answered conservatively with a small BVH over spheres that
+    // enclose both positions of each moved sphere.
+    std::vector<Sphere> swept;
+    for (const Move &m : moved) {
+        Vec d = m.to - m.from;
+        swept.emplace_back((m.from + m.to) * Real(0.5), spheres[m.i].r + std::sqrt(dot(d, d)) / 2, spheres[m.i].m);
+    }
+    BVH sweptBvh;
+    sweptBvh.build(swept);
+    auto touches = [&](const Ray& ray, Real tmax) { int k; return sweptBvh.occluded(ray, tmax, k); };
+    std::vector<char> isMoved(spheres.size(), 0);
+    for (const Move &m : moved) isMoved[m.i] = 1;
+    const bool reuse = incremental && haveprev && !camMoved;
+
+    t0 = Clock::now();
+    std::vector<Tile> tiles = make_tiles(cam.width, cam.height, tileSize);
+    std::vector<long long> reusedBy(threads, 0);
+    run_tiles((int)tiles.size(), threads, [&](int t, int thread) {
+        const Tile &tl = tiles[t];
+        for (int j = tl.y0; j < tl.y1; ++j)
+            for (int i = tl.x0; i < tl.x1; ++i) {
+                size_t p = (size_t)j * cam.width + i;
+                Ray ray = cam.primary(i + 0.5, j + 0.5);
+                if (reuse && hitId[p] != -2) { // -2: last frame's hit was reflective
+                    int id = hitId[p];
+                    bool same = !(id >= 0 && prim_kind(id) == PRIM_SPHERE && isMoved[id]) && !touches(ray, hitT[p]);
+                    if (same && id >= 0) {
+                        SurfaceHit s(ray, hitT[p], id);
+                        for (int k = 0; k < s.light_samples() && same; ++k) {
+                            LightSample ls = s.light_sample(k);
+                            same = !touches(ls.shadowRay, ls.dist);
+                        }
+                    }
+                    if (same) { ++reusedBy[thread]; continue; }
+                }
+                ++rayCounts.primary;
+                Real tHit; int id;
+                bool hitAny = scene_intersect(ray, tHit, id);
+                store_pixel(i, j, shade(ray, hitAny, tHit, id, 0), fb);
+                hitT[p] = hitAny ? tHit : INF;
+                hitId[p] = !hitAny ? -1 : prim_material(id).reflect > 1e-6 ? -2 : id;
+            }
+    });
+    fs.renderMs = ms_since(t0);
+    for (long long r : reusedBy) fs.reused += r;
+    return fs;
+}
+
+// 64-bit hash of a framebuffer's floats, to compare frames across passes
+uint64_t hash_frame(const Framebuffer& fb) {
+    uint64_t h = 0;
+    for (size_t k = 0; k < fb.rgb.size(); k += 2) {
+        uint64_t b = 0;
+        std::memcpy(&b, &fb.rgb[k], std::min<size_t>(2, fb.rgb.size() - k) * sizeof(float));
+        h = mix64(h ^ b);
+    }
+    return h;
+}
+
+// Renders every frame to <prefix>NNNN.ppm with per-frame timings as CSV.
+// compare first renders the whole sequence naively (BVH rebuild and full
+// trace every frame) and reports its times and whether the frames match.
+bool render_animation(const Animation& anim, int threads, int tileSize, ToneOp toneOp,
+                      const std::string& prefix, bool compare) {
+    const std::vector<Sphere> start = spheres;
+    Camera cam(Vec(0, 0, 0), M_PI/3.0, 800, 600);
+    const Vec camStart = cam.pos;
+    Framebuffer fb(cam.width, cam.height);
+    std::vector<int> hitId(fb.rgb.size() / 3, -2);
+    std::vector<Real> hitT(hitId.size(), INF);
+    std::vector<double> naiveMs;
+    std::vector<uint64_t> naiveHash;
+    if (compare) {
+        for (int f = 0; f < anim.frames; ++f) {
+            FrameStats fs = render_frame(anim, f, cam, fb, hitId, hitT, f > 0, false, threads, tileSize);
+            naiveMs.push_back(fs.bvhMs + fs.renderMs);
+            naiveHash.push_back(hash_frame(fb));
+        }
+        spheres = start; cam.pos = camStart;
+        bvh.build(spheres); // the tree a run without compare starts from
+    }
+
+    ToneLUT lut;
+    lut.build(toneOp);
+    std::vector<unsigned char> img;
+    std::cout << "frame,moved,bvh,bvh_ms,render_ms,reused_pct,total_ms" << (compare ? ",naive_ms,speedup,identical" : "") << "\n";
+    double sum = 0, naiveSum = 0;
+    int mismatches = 0;
+    for (int f = 0; f < anim.frames; ++f) {
+        FrameStats fs = render_frame(anim, f, cam, fb, hitId, hitT, f > 0, true, threads, tileSize);
+        double ms = fs.bvhMs + fs.renderMs;
+        sum += ms;
+        std::cout << f << "," << fs.moved << "," << fs.bvhAction << ","
+                  << fs.bvhMs << "," << fs.renderMs << "," << 100.0 * fs.reused / hitId.size() << "," << ms;
+        if (compare) {
+            bool same = hash_frame(fb) == naiveHash[f];
+            mismatches += !same;
+            naiveSum += naiveMs[f];
+            std::cout << "," << naiveMs[f] << "," << naiveMs[f] / ms << "," << (same ? "yes" : "NO");
+        }
+        std::cout << "\n";
+        tonemap(fb, lut, img, threads);
+        char name[32];
+        std::snprintf(name, sizeof name, "%04d.ppm", f);
+        if (!write_ppm(prefix + name, fb.width, fb.height, img)) return false;
+    }
+    std::cout << "Wrote " << anim.frames << " frames " << prefix << "0000.ppm.. in " << sum << " ms";
+    if (compare) std::cout << " (naive " << naiveSum << " ms, " << mismatches << " frames differ)";
+    std::cout << "\n";
+    return mismatches == 0;
+}
+
+// per-tile CSV followed by a per-thread summary of busy time
+void print_tile_stats(const std::vector<TileStat>& stats, const std::vector<Tile>& tiles, int threads) {
+    std::cout << "tile,x0,y0,thread,ms\n";
+    std::vector<double> busy(threads, 0.0); std::vector<int> count(threads, 0);
+    for (const TileStat &st : stats) {
+        const Tile &tl = tiles[st.tile];
+        std::cout << st.tile << "," << tl.x0 << "," << tl.y0 << "," << st.thread << "," << st.ms << "\n";
+        busy[st.thread] += st.ms; count[st.thread]++;
+    }
+    for (int t = 0; t < threads; ++t)
+        std::cout << "thread " << t << ": " << count[t] << " tiles, " << busy[t] << " ms busy\n";
+}
+
+// BVH vs linear scan: build time and closest-hit throughput on random scenes
+void bench_bvh() {
+    const int sizes[] = {10, 1000, 100000, 1000000};
+    std::cout << "spheres,build_ms,bvh_nodes,bvh_mrays_s,linear_mrays_s,mismatches\n";
+    for (int n : sizes) {
+        build_random_scene(n);
+        auto t0 = Clock::now();
+        bvh.build(spheres);
+        double buildMs = ms_since(t0);
+
+        // primary rays on a 320x240 grid
+        std::vector<Ray> rays;
+        Camera cam(Vec(0,0,0), M_PI/3.0, 320, 240);
+        for (int j=0;j<cam.height;++j) for (int i=0;i<cam.width;++i)
+            rays.push_back(cam.primary(i+0.5, j+0.5));
+
+        std::vector<int> ids(rays.size());
+        Real t; int id;
+        t0 = Clock::now();
+        for (size_t k=0;k<rays.size();++k){ bvh.intersect(rays[k], t, id); ids[k] = id; }
+        double bvhMs = ms_since(t0);
+
+        // keep the linear scan to roughly 1e9 sphere tests
+        size_t linCount = std::min(rays.size(), std::max<size_t>(64, (size_t)(1e9 / n)));
+        size_t stride = rays.size() / linCount;
+        int mismatches = 0;
+        t0 = Clock::now();
+        for (size_t k=0;k<rays.size();k+=stride){
+            scene_intersect_linear(rays[k], t, id);
+            if (id != ids[k]) ++mismatches;
+        }
+        double linMs = ms_since(t0);
+        size_t linRays = (rays.size() + stride - 1) / stride;
+
+        std::cout << n << "," << buildMs << "," << bvh.nodes.size() << ","
+                  << rays.size() / (bvhMs * 1e3) << "," << linRays / (linMs * 1e3) << ","
+                  << mismatches << "\n";
+    }
+}
+
+// scalar vs SIMD sphere kernels: linear scan over an unsorted SoA store and
+// BVH leaves, plus the packet traversal for primary rays. Reports throughput
+// and the largest closest-hit distance difference against the scalar path.
+void bench_simd() {
+    std::cout << "simd_lanes," << SIMD_W << "\n";
+    std::cout << "spheres,path,mrays_s,max_abs_dt,id_mismatches\n";
+    Camera cam(Vec(0,0,0), M_PI/3.0, 320, 240);
+    std::vector<Ray> rays;
+    for (int j=0;j<cam.height;++j) for (int i=0;i<cam.width;++i)
+        rays.push_back(cam.primary(i+0.5, j+0.5));
+    const size_t nr = rays.size();
+    std::vector<Real> refT(nr), outT(nr);
+    std::vector<int> refId(nr), outId(nr);
+
+    auto report = [&](int n, const char* path, double ms, bool isRef) {
+        double maxDt = 0; int mism = 0;
+        for (size_t k=0;k<nr && !isRef;++k){
+            if (refId[k] != outId[k]) { ++mism; continue; }
+            if (refId[k] >= 0) maxDt = std::max(maxDt, (double)std::fabs(refT[k] - outT[k]));
+        }
+        std::cout << n << "," << path << "," << nr / (ms * 1e3) << "," << maxDt << "," << mism << "\n";
+    };
+
+    for (int n : {1000, 100000}) {
+        build_random_scene(n);
+        bvh.build(spheres);
+
+        // linear scan: scalar reference and the SoA kernel in natural order
+        if (n <= 1000) {
+            auto t0 = Clock::now();
+            for (size_t k=0;k<nr;++k) scene_intersect_linear(rays[k], refT[k], refId[k]);
+            report(n, "linear_scalar", ms_since(t0), true);
+            std::vector<int> order(spheres.size());
+            for (size_t i=0;i<order.size();++i) order[i] = (int)i;
+            SphereSoA flat; flat.build(spheres, order);
+            t0 = Clock::now();
+            for (size_t k=0;k<nr;++k){
+                outT[k] = INF; int slot = -1;
+                flat.intersect(rays[k], 0, flat.count, outT[k], slot);
+                outId[k] = slot;
+            }
+            report(n, "linear_simd", ms_since(t0), false);
+        }
+
+        useSIMD = false;
+        auto t0 = Clock::now();
+        for (size_t k=0;k<nr;++k) bvh.intersect(rays[k], refT[k], refId[k]);
+        report(n, "bvh_scalar", ms_since(t0), true);
+        useSIMD = true;
+        t0 = Clock::now();
+        for (size_t k=0;k<nr;++k) bvh.intersect(rays[k], outT[k], outId[k]);
+        report(n, "bvh_simd", ms_since(t0), false);
+        t0 = Clock::now();
+        for (size_t k=0;k+SIMD_W<=nr;k+=SIMD_W) bvh.intersect_packet(&rays[k], &outT[k], &outId[k]);
+        report(n, "bvh_packet", ms_since(t0), false);
+    }
+}
+
+// shadow-ray cost: closest-hit test (the old way) vs any-hit occlusion query,
+// with and without the last-occluder cache, on shadow rays from primary hits.
+// Throughput is given for all shadow rays and for the blocked ones alone,
+// which is where the early exit and the cache pay off.
+void bench_shadow() {
+    std::cout << "spheres,path,mrays_s,blocked_mrays_s,occluded_frac,mismatches\n";
+    Camera cam(Vec(0,0,0), M_PI/3.0, 320, 240);
+    for (int n : {1000, 100000, 1000000}) {
+        build_random_scene(n);
+        bvh.build(spheres);
+        std::vector<SurfaceHit> pts;
+        for (int j=0;j<cam.height;++j) for (int i=0;i<cam.width;++i){
+            Ray r = cam.primary(i+0.5, j+0.5);
+            Real t; int id;
+            if (scene_intersect(r, t, id)) pts.push_back(SurfaceHit(r, t, id));
+        }
+        auto closest = [](const SurfaceHit& p) {
+            Real ts; int sid;
+            LightSample ls = p.light_sample(0);
+            return scene_intersect(ls.shadowRay, ts, sid) && ts < ls.dist - 1e-6;
+        };
+        std::vector<char> ref(pts.size());
+        for (size_t k=0;k<pts.size();++k) ref[k] = closest(pts[k]);
+        std::vector<SurfaceHit> blocked;
+        for (size_t k=0;k<pts.size();++k) if (ref[k]) blocked.push_back(pts[k]);
+
+        auto run = [&](const char* path, bool cache, bool anyHit) {
+            useOccluderCache = cache; lastOccluder = -1;
+            std::vector<char> out(pts.size());
+            auto t0 = Clock::now();
+            for (size_t k=0;k<pts.size();++k) out[k] = anyHit ? pts[k].in_shadow() != 0 : closest(pts[k]);
+            double ms = ms_since(t0);
+            lastOccluder = -1;
+            t0 = Clock::now();
+            int found = 0;
+            for (const SurfaceHit &p : blocked) found += anyHit ? p.in_shadow() != 0 : closest(p);
+            double blockedMs = ms_since(t0);
+            int occ = 0, mism = 0;
+            for (size_t k=0;k<pts.size();++k){ occ += out[k]; mism += out[k] != ref[k]; }
+            mism += (int)blocked.size() - found;
+            std::cout << n << "," << path << "," << pts.size() / (ms * 1e3) << ","
+                      << blocked.size() / (blockedMs * 1e3) << ","
+                      << occ / (double)std::max<size_t>(1, pts.size()) << "," << mism << "\n";
+        };
+        run("closest_hit", false, false);
+        run("any_hit", false, true);
+        run("any_hit_cached", true, true);
+    }
+    useOccluderCache = true;
+}
+
+// output stage cost: per-channel pow() against the tone LUT, serial and on
+// all cores, over a 1920x1080 buffer of log-uniform radiance in [2^-20, 2^10]
+void bench_tonemap() {
+    Framebuffer fb(1920, 1080);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> e(-20, 10);
+    for (float &v : fb.rgb) v = std::exp2(e(rng));
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << "op,lut_build_ms,wide_buckets,exact_ms,lut_ms,lut_parallel_ms,threads,mismatches\n";
+    const char* names[] = {"clamp", "reinhard", "aces"};
+    for (ToneOp op : {TONE_CLAMP, TONE_REINHARD, TONE_ACES}) {
+        ToneLUT lut;
+        auto t0 = Clock::now();
+        int wide = lut.build(op);
+        double buildMs = ms_since(t0);
+
+        std::vector<unsigned char> ref(fb.rgb.size()), out;
+        t0 = Clock::now();
+        for (size_t k = 0; k < fb.rgb.size(); ++k) ref[k] = encode_exact(op, fb.rgb[k]);
+        double exactMs = ms_since(t0);
+        t0 = Clock::now();
+        tonemap(fb, lut, out, 1);
+        double lutMs = ms_since(t0);
+        t0 = Clock::now();
+        tonemap(fb, lut, out, cores);
+        double parMs = ms_since(t0);
+
+        size_t mism = 0;
+        for (size_t k = 0; k < ref.size(); ++k) mism += ref[k] != out[k];
+        std::cout << names[op] << "," << buildMs << "," << wide << "," << exactMs << "," << lutMs << ","
+                  << parMs << "," << cores << "," << mism << "\n";
+    }
+}
+
+// shading cost against light count on 1000 random spheres at 320x240: every
+// light per hit (up to MAX_LIGHT_SAMPLES lights) vs a fixed number of lights
+// sampled from the alias table. rmse is against the every-light render, on
+// colours clamped to [0,1] so a few hot pixels next to a light do not dominate.
+void bench_lights() {
+    std::cout << "lights,samples,ms,shadow_rays,mrays_s,rmse_vs_all\n";
+    Camera cam(Vec(0,0,0), M_PI/3.0, 320, 240);
+    build_random_scene(1000);
+    bvh.build(spheres);
+    int savedSamples = lightSamples;
+    for (int n : {1, 16, 64, 256, 4096, 65536}) {
+        build_random_lights(n);
+        Framebuffer ref(cam.width, cam.height);
+        bool haveRef = false;
+        const int counts[] = {n, 1, 4};
+        for (int c = 0; c < 3; ++c) {
+            int s = counts[c];
+            if (c == 0 ? s > MAX_LIGHT_SAMPLES : s >= n) continue; // too many to do exactly / same as all
+            lightSamples = s;
+            Framebuffer fb(cam.width, cam.height);
+            reset_ray_counts();
+            auto t0 = Clock::now();
+            for (int j = 0; j < cam.height; ++j) render_span(cam, j, 0, cam.width, fb);
+            double ms = ms_since(t0);
+            RayCounts rc = collect_ray_counts();
+            std::cout << n << "," << (s == n ? "all" : std::to_string(s)) << "," << ms << "," << rc.shadow << ","
+                      << rc.total() / (ms * 1e3) << ",";
+            if (c == 0) { ref.rgb = fb.rgb; haveRef = true; std::cout << "0\n"; continue; }
+            if (!haveRef) { std::cout << "\n"; continue; }
+            double sq = 0;
+            for (size_t k = 0; k < fb.rgb.size(); ++k) {
+                double d = std::min(1.0f, fb.rgb[k]) - std::min(1.0f, ref.rgb[k]);
+                sq += d * d;
+            }
+            std::cout << std::sqrt(sq / fb.rgb.size()) << "\n";
+        }
+    }
+    lightSamples = savedSamples;
+}
+
+// adaptive vs uniform supersampling at 800x600; rmse is on colours clamped
+// to [0,1], against uniform 16 spp
+void bench_aa(int threads) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "scene,mode,max_spp,threshold,ms,avg_spp,refined_pct,rmse_vs_uniform16\n";
+    struct Run { const char* mode; int maxSpp; double threshold; };
+    const Run runs[] = {{"uniform", 16, -1}, {"1spp", 1, 0}, {"adaptive", 16, 0.1},
+                        {"adaptive", 16, 0.05}, {"adaptive", 64, 0.05}};
+    for (int sc = 0; sc < 2; ++sc) {
+        if (sc == 0) build_demo_scene(); else build_random_scene(1000);
+        bvh.build(spheres);
+        Camera cam(Vec(0,0,0), M_PI/3.0, 800, 600);
+        Framebuffer ref(cam.width, cam.height);
+        for (const Run &r : runs) {
+            Framebuffer fb(cam.width, cam.height);
+            auto t0 = Clock::now();
+            render_parallel(cam, fb, threads, 32, nullptr);
+            AAStats st = refine_adaptive(cam, fb, r.maxSpp, r.threshold, threads, 32);
+            double ms = ms_since(t0);
+            double pixels = (double)cam.width * cam.height, sq = 0;
+            if (r.threshold < 0) ref.rgb = fb.rgb;
+            for (size_t k = 0; k < fb.rgb.size(); ++k) {
+                double d = std::min(1.0f, fb.rgb[k]) - std::min(1.0f, ref.rgb[k]);
+                sq += d * d;
+            }
+            std::cout << (sc == 0 ? "demo" : "s1k") << "," << r.mode << "," << r.maxSpp << "," << r.threshold << ","
+                      << ms << "," << st.samples / pixels << "," << 100.0 * st.refined / pixels << ","
+                      << std::sqrt(sq / fb.rgb.size()) << "\n";
+        }
+    }
+}
+
+// Denoised low-sample previews against a converged render. The demo's key
+// light is swapped for a sphere light so shadows have noisy penumbrae; the
+// reference is 64 spp, every run uses uniform sampling.
+void bench_denoise(int threads) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    build_demo_scene();
+    bvh.build(spheres);
+    lights.assign(1, Light::sphere(Vec(5, 10, -2), 3, Vec(1, 1, 1), false));
+    lightTable.build(lights);
+    Camera cam(Vec(0,0,0), M_PI/3.0, 800, 600);
+
+    auto render = [&](Framebuffer& fb, int spp) {
+        fb.enable_aovs();
+        render_parallel(cam, fb, threads, 32, nullptr);
+        if (spp > 1) refine_adaptive(cam, fb, spp, -1, threads, 32);
+    };
+    Framebuffer ref(cam.width, cam.height);
+    auto t0 = Clock::now();
+    render(ref, 64);
+    double refMs = ms_since(t0);
+
+    std::cout << "spp,mode,ms,denoise_ms,rmse_vs_64spp\n";
+    std::cout << "64,reference," << refMs << ",0,0\n";
+    for (int spp : {1, 2, 4, 16})
+        for (int den = 0; den < 2; ++den) {
+            Framebuffer fb(cam.width, cam.height);
+            t0 = Clock::now();
+            render(fb, spp);
+            auto t1 = Clock::now();
+            if (den) denoise(fb, threads);
+            double denMs = ms_since(t1), ms = ms_since(t0), sq = 0;
+            for (size_t k = 0; k < fb.rgb.size(); ++k) {
+                double d = std::min(1.0f, fb.rgb[k]) - std::min(1.0f, ref.rgb[k]);
+                sq += d * d;
+            }
+            std::cout << spp << "," << (den ? "denoised" : "raw") << "," << ms << "," << (den ? denMs : 0.0) << ","
+                      << std::sqrt(sq / fb.rgb.size()) << "\n";
+        }
+}
+
+// ---------- image comparison ----------
+bool read_ppm(const std::string& path, int &w, int &h, std::vector<unsigned char>& px) {
+    std::ifstream in(path, std::ios::binary);
+    std::string magic; int maxv;
+    if (!(in >> magic >> w >> h >> maxv) || magic != "P6" || maxv != 255) {
+        std::cerr << path << ": not a binary PPM\n"; return false;
+    }
+    in.get();
+    px.resize((size_t)w * h * 3);
+    in.read(reinterpret_cast<char*>(px.data()), px.size());
+    if (!in) { std::cerr << path << ": truncated\n"; return false; }
+    return true;
+}
+
+// per-channel difference statistics between two PPMs of the same size
+int compare_ppm(const std::string& a, const std::string& b) {
+    int wa, ha, wb, hb;
+    std::vector<unsigned char> pa, pb;
+    if (!read_ppm(a, wa, ha, pa) || !read_ppm(b, wb, hb, pb)) return 1;
+    if (wa != wb || ha != hb) { std::cerr << "image sizes differ\n"; return 1; }
+    double sum = 0, sq = 0; int maxd = 0; size_t pixelsDiff = 0;
+    for (size_t p = 0; p < pa.size(); p += 3) {
+        bool diff = false;
+        for (int c = 0; c < 3; ++c) {
+            int d = std::abs((int)pa[p+c] - (int)pb[p+c]);
+            sum += d; sq += d*d; maxd = std::max(maxd, d);
+            diff |= d != 0;
+        }
+        pixelsDiff += diff;
+    }
+    double mse = sq / pa.size();
+    std::cout << "mean_abs_diff," << sum / pa.size() << "\n"
+              << "max_abs_diff," << maxd << "\n"
+              << "pixels_differing_pct," << 100.0 * pixelsDiff / (pa.size() / 3) << "\n"
+              << "psnr_db," << (mse > 0 ? 10 * std::log10(255.0*255.0 / mse) : INFINITY) << "\n";
+    return 0;
+}
+
+// ---------- render benchmark ----------
+struct BenchScene { const char* name; int spheres; double reflectFrac; int width, height; };
+
+// peak resident set size of the whole process so far, in KB
+long peak_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// name -> Mrays/s from a CSV written by a previous --bench-render run
+std::map<std::string, double> read_bench_baseline(const std::string& path) {
+    std::map<std::string, double> base;
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line); // header
+    while (std::getline(in, line)) {
+        std::vector<std::string> f;
+        std::istringstream ls(line);
+        std::string cell;
+        while (std::getline(ls, cell, ',')) f.push_back(cell);
+        if (f.size() >= 10) base[f[0]] = std::atof(f[9].c_str());
+    }
+    return base;
+}
+
+// Renders procedural scenes of growing size, reflectivity and resolution and
+// prints one CSV row (or JSON object) per scene. With a baseline, any scene
+// whose Mrays/s drops more than thresholdPct below it is flagged and the
+// return value is nonzero.
+int bench_render(int threads, bool json, const std::string& baselinePath, double thresholdPct) {
+    const BenchScene scenes[] = {
+        {"demo_800x600",          0, 0.0,  800, 600},
+        {"s1k_r20_640x480",    1000, 0.2,  640, 480},
+        {"s10k_r20_640x480",  10000, 0.2,  640, 480},
+        {"s100k_r20_640x480",100000, 0.2,  640, 480},
+        {"s10k_r0_640x480",   10000, 0.0,  640, 480},
+        {"s10k_r80_640x480",  10000, 0.8,  640, 480},
+        {"s10k_r20_320x240",  10000, 0.2,  320, 240},
+        {"s10k_r20_1280x960", 10000, 0.2, 1280, 960},
+    };
+    std::map<std::string, double> base;
+    if (!baselinePath.empty()) {
+        base = read_bench_baseline(baselinePath);
+        if (base.empty()) { std::cerr << "no baseline rows in " << baselinePath << "\n"; return 1; }
+    }
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    int regressions = 0;
+    if (json) std::cout << "[\n";
+    else std::cout << "scene,spheres,reflect_frac,width,height,ms,primary,shadow,reflection,mrays_s,peak_rss_kb,status\n";
+    bool firstRow = true;
+    for (const BenchScene &sc : scenes) {
+        if (sc.spheres == 0) build_demo_scene();
+        else build_random_scene(sc.spheres, 1, sc.reflectFrac);
+        bvh.build(spheres);
+        Camera cam(Vec(0,0,0), M_PI/3.0, sc.width, sc.height);
+        Framebuffer fb(sc.width, sc.height);
+
+        reset_ray_counts();
+        auto t0 = Clock::now();
+        if (threads == 1) for (int j = 0; j < sc.height; ++j) render_span(cam, j, 0, sc.width, fb);
+        else render_parallel(cam, fb, threads, 32, nullptr);
+        double ms = ms_since(t0);
+        RayCounts rc = collect_ray_counts();
+        double mrays = rc.total() / (ms * 1e3);
+
+        std::string status = "ok";
+        auto it = base.find(sc.name);
+        if (!baselinePath.empty()) {
+            if (it == base.end()) status = "no_baseline";
+            else if (mrays < it->second * (1.0 - thresholdPct / 100.0)) { status = "REGRESSION"; ++regressions; }
+        }
+
+        if (json) {
+            std::cout << (firstRow ? "" : ",\n") << "  {\"scene\": \"" << sc.name << "\", \"spheres\": " << spheres.size()
+                      << ", \"reflect_frac\": " << sc.reflectFrac << ", \"width\": " << sc.width
+                      << ", \"height\": " << sc.height << ", \"ms\": " << ms
+                      << ", \"primary\": " << rc.primary << ", \"shadow\": " << rc.shadow
+                      << ", \"reflection\": " << rc.reflection << ", \"mrays_s\": " << mrays
+                      << ", \"peak_rss_kb\": " << peak_rss_kb() << ", \"status\": \"" << status << "\"}";
+        } else {
+            std::cout << sc.name << "," << spheres.size() << "," << sc.reflectFrac << "," << sc.width << ","
+                      << sc.height << "," << ms << "," << rc.primary << "," << rc.shadow << ","
+                      << rc.reflection << "," << mrays << "," << peak_rss_kb() << "," << status << "\n";
+        }
+        firstRow = false;
+    }
+    if (json) std::cout << "\n]\n";
+    if (regressions) std::cerr << regressions << " scene(s) more than " << thresholdPct
+                               << "% slower than " << baselinePath << "\n";
+    return regressions ? 2 : 0;
+}
+
+int main(int argc, char** argv){
+    int randomSpheres = 0;
+    int threads = 1, tileSize = 32;
+    bool tileTimes = false, wavefront = false;
+    std::string sceneFile, saveScene, saveText;
+    bool benchRender = false, benchJson = false;
+    std::string benchBaseline;
+    double benchThreshold = 10.0;
+    bool saveBVH = true;
+    ToneOp toneOp = TONE_CLAMP;
+    std::string pfmFile;
+    bool groundPlane = false;
+    int randomLights = 0;
+    int aaMax = 1;
+    double aaThreshold = 0.1;
+    bool benchAA = false;
+    bool denoiseOn = false, benchDenoise = false;
+    int workers = 0;
+    bool workerFaults = false;
+    bool printStats = false;
+    std::string animFile, framePrefix = "frame_";
+    bool animCompare = false;
+    std::string statsJson;
+    std::string checkpointFile;
+    bool resume = false;
+    double checkpointEvery = 5;
+    std::vector<std::string> objFiles;
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        if (arg == "--bench-bvh") { bench_bvh(); return 0; }
+        else if (arg == "--linear") useBVH = false;
+        else if (arg == "--scalar") useSIMD = false;
+        else if (arg == "--bench-simd") { bench_simd(); return 0; }
+        else if (arg == "--bench-shadow") { bench_shadow(); return 0; }
+        else if (arg == "--bench-render") benchRender = true;
+        else if (arg == "--bench-tonemap") { bench_tonemap(); return 0; }
+        else if (arg == "--bench-lights") { bench_lights(); return 0; }
+        else if (arg == "--bench-aa") benchAA = true;
+        else if (arg == "--aa" && a+1 < argc) aaMax = std::max(1, std::atoi(argv[++a]));
+        else if (arg == "--denoise") denoiseOn = true;
+        else if (arg == "--workers" && a+1 < argc) workers = std::max(1, std::atoi(argv[++a]));
+        else if (arg == "--worker-faults") workerFaults = true;
+        else if (arg == "--stats") printStats = true;
+        else if (arg == "--animate" && a+1 < argc) animFile = argv[++a];
+        else if (arg == "--frame-prefix" && a+1 < argc) framePrefix = argv[++a];
+        else if (arg == "--animate-compare") animCompare = true;
+        else if (arg == "--stats-json" && a+1 < argc) statsJson = argv[++a];
+        else if (arg == "--checkpoint" && a+1 < argc) { checkpointFile = argv[++a]; resume = false; }
+        else if (arg == "--resume" && a+1 < argc) { checkpointFile = argv[++a]; resume = true; }
+        else if (arg == "--checkpoint-every" && a+1 < argc) checkpointEvery = std::max(0.0, std::atof(argv[++a]));
+        else if (arg == "--bench-denoise") benchDenoise = true;
+        else if (arg == "--aa-threshold" && a+1 < argc) aaThreshold = std::atof(argv[++a]);
+        else if (arg == "--lights" && a+1 < argc) randomLights = std::max(1, std::atoi(argv[++a]));
+        else if (arg == "--light-samples" && a+1 < argc)
+            lightSamples = std::min(MAX_LIGHT_SAMPLES, std::max(1, std::atoi(argv[++a])));
+        else if (arg == "--compare-ppm" && a+2 < argc) return compare_ppm(argv[a+1], argv[a+2]);
+        else if (arg == "--json") benchJson = true;
+        else if (arg == "--baseline" && a+1 < argc) benchBaseline = argv[++a];
+        else if (arg == "--threshold" && a+1 < argc) benchThreshold = std::atof(argv[++a]);
+        else if (arg == "--spheres" && a+1 < argc) randomSpheres = std::atoi(argv[++a]);
+        else if (arg == "--threads" && a+1 < argc) threads = std::atoi(argv[++a]);
+        else if (arg == "--tile" && a+1 < argc) tileSize = std::max(1, std::atoi(argv[++a]));
+        else if (arg == "--tile-times") tileTimes = true;
+        else if (arg == "--wavefront") wavefront = true;
+        else if (arg == "--scene" && a+1 < argc) sceneFile = argv[++a];
+        else if (arg == "--save-scene" && a+1 < argc) saveScene = argv[++a];
+        else if (arg == "--save-text" && a+1 < argc) saveText = argv[++a];
+        else if (arg == "--no-save-bvh") saveBVH = false;
+        else if (arg == "--convert" && a+2 < argc) {
+            auto t0 = Clock::now();
+            if (!load_scene_text(argv[a+1])) return 1;
+            double parseMs = ms_since(t0);
+            t0 = Clock::now();
+            if (!save_scene_file(argv[a+2], saveBVH)) return 1;
+            std::cout << "Converted " << spheres.size() << " spheres: parse " << parseMs
+                      << " ms, write " << ms_since(t0) << " ms\n";
+            return 0;
+        }
+        else if (arg == "--max-depth" && a+1 < argc) maxDepth = std::max(0, std::atoi(argv[++a]));
+        else if (arg == "--tonemap" && a+1 < argc) {
+            std::string op = argv[++a];
+            if (op == "clamp") toneOp = TONE_CLAMP;
+            else if (op == "reinhard") toneOp = TONE_REINHARD;
+            else if (op == "aces") toneOp = TONE_ACES;
+            else { std::cerr << "unknown tone operator " << op << " (clamp, reinhard, aces)\n"; return 1; }
+        }
+        else if (arg == "--pfm" && a+1 < argc) pfmFile = argv[++a];
+        else if (arg == "--ground-plane") groundPlane = true;
+        else if (arg == "--obj" && a+1 < argc) objFiles.push_back(argv[++a]);
+        else {
+            std::cerr << "usage: " << argv[0] << " [--spheres N] [--linear] [--scalar] [--bench-bvh] [--bench-simd] [--bench-shadow] [--bench-tonemap] [--bench-lights] [--bench-aa] [--bench-denoise]"
+                      << " [--bench-render [--json] [--baseline CSV] [--threshold PCT]]"
+                      << " [--threads N] [--tile S] [--tile-times] [--wavefront] [--max-depth D]"
+                      << " [--scene FILE] [--save-scene FILE] [--save-text FILE] [--no-save-bvh]"
+                      << " [--convert TEXT BIN] [--compare-ppm A B] [--tonemap clamp|reinhard|aces] [--pfm FILE]"
+                      << " [--ground-plane] [--obj FILE] [--lights N] [--light-samples S]"
+                      << " [--aa MAX_SPP] [--aa-threshold T] [--denoise] [--workers N [--worker-faults]]"
+                      << " [--checkpoint FILE | --resume FILE] [--checkpoint-every SEC]"
+                      << " [--stats] [--stats-json FILE] [--animate SCRIPT [--frame-prefix P] [--animate-compare]]\n";
+            return 1;
+        }
+    }
+
+    if (benchRender) return bench_render(threads, benchJson, benchBaseline, benchThreshold);
+    if (benchAA) { bench_aa(threads); return 0; }
+    if (benchDenoise) { bench_denoise(threads); return 0; }
+
+    if (!sceneFile.empty()) {
+        auto t0 = Clock::now();
+        if (!(is_scene_file(sceneFile) ? load_scene_file(sceneFile) : load_scene_text(sceneFile))) return 1;
+        std::cout << "Loaded " << scene_size() << " spheres";
+        if (scene_has_flat())
+            std::cout << ", " << planes.size() << " planes, " << triangles.size() << " triangles, "
+                      << meshes.size() << " meshes";
+        std::cout << " from " << sceneFile << " in " << ms_since(t0) << " ms\n";
+    } else if (randomSpheres > 0) {
+        build_random_scene(randomSpheres);
+    } else {
+        // build a simple scene
+        build_demo_scene(groundPlane);
+    }
+    for (const std::string &f : objFiles)
+        if (!load_obj(f, Material(Vec(0.9, 0.7, 0.3), 0.2))) return 1;
+    if (randomLights > 0) build_random_lights(randomLights);
+    if (!saveText.empty() || !saveScene.empty()) {
+        if (mappedScene.count) { std::cerr << "cannot re-save a mapped scene\n"; return 1; }
+        if (!saveText.empty() && !save_scene_text(saveText)) return 1;
+        if (!saveScene.empty() && !save_scene_file(saveScene, saveBVH)) return 1;
+        return 0;
+    }
+    if (useBVH && !bvh.built()) bvh.build(spheres);
+    if (scene_has_flat()) build_triangle_bvh();
+
+    if (!animFile.empty()) {
+        if (mappedScene.count) { std::cerr << "--animate needs an in-memory scene, not a mapped one\n"; return 1; }
+        Animation anim;
+        if (!load_animation(animFile, anim)) return 1;
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        return render_animation(anim, threads, tileSize, toneOp, framePrefix, animCompare) ? 0 : 1;
+    }
+
+    // image
+    const int width = 800;
+    const int height = 600;
+    const double fov = M_PI/3.0; // 60 degrees
+
+    Framebuffer fb(width, height);
+    if (denoiseOn) fb.enable_aovs();
+
+    Camera cam(Vec(0, 0, 0), fov, width, height);
+
+    reset_ray_counts();
+    auto renderStart = Clock::now();
+    AAStats aaStats;
+    const bool tileJobs = workers > 0 || !checkpointFile.empty(); // AA done per tile by the renderer
+    if (!checkpointFile.empty()) {
+        if (workers > 0 || wavefront) { std::cerr << "--checkpoint/--resume use the tiled renderer, not --workers or --wavefront\n"; return 1; }
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        CheckpointStats cs;
+        auto t0 = Clock::now();
+        if (!render_checkpointed(cam, fb, threads, tileSize, aaMax, aaThreshold, checkpointFile, resume,
+                                 checkpointEvery * 1000, cs)) return 1;
+        aaStats = cs.aa;
+        std::cout << "Rendered " << cs.tiles - cs.resumed << " of " << cs.tiles << " tiles (" << cs.resumed
+                  << " resumed) on " << threads << " threads in " << ms_since(t0) << " ms; checkpoint "
+                  << checkpointFile << ": " << cs.bytes / 1024 << " KiB in " << cs.flushes << " writes, writer busy "
+                  << cs.writerMs << " ms\n";
+    } else if (workers > 0) {
+        auto t0 = Clock::now();
+        DistStats ds = render_distributed(cam, fb, workers, tileSize, aaMax, aaThreshold, workerFaults);
+        aaStats = ds.aa;
+        std::cout << "Distributed render on " << workers << " workers in " << ms_since(t0) << " ms: "
+                  << ds.tiles << " tiles, " << ds.failed << " workers failed, " << ds.slow << " slow tiles copied, "
+                  << ds.duplicates << " duplicate results dropped, " << ds.local << " tiles rendered locally\n";
+    } else if (wavefront) {
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        auto t0 = Clock::now();
+        render_wavefront(cam, fb, threads);
+        std::cout << "Wavefront render on " << threads << " threads in " << ms_since(t0) << " ms\n";
+    } else if (threads == 1 && !tileTimes) {
+        for (int j = 0; j < height; ++j) {
+            render_span(cam, j, 0, width, fb);
+            if ((j%50)==0) std::cout << "scanline " << j << "/" << height << "\n";
+        }
+    } else {
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<TileStat> stats;
+        auto t0 = Clock::now();
+        render_parallel(cam, fb, threads, tileSize, tileTimes ? &stats : nullptr);
+        std::cout << "Rendered on " << threads << " threads in " << ms_since(t0) << " ms\n";
+        if (tileTimes) print_tile_stats(stats, make_tiles(width, height, tileSize), threads);
+    }
+
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    if (aaMax > 1) {
+        auto t0 = Clock::now();
+        if (!tileJobs) aaStats = refine_adaptive(cam, fb, aaMax, aaThreshold, threads, tileSize);
+        double pixels = (double)width * height;
+        std::cout << "Adaptive AA";
+        if (!tileJobs) std::cout << " in " << ms_since(t0) << " ms";
+        std::cout << ": " << 100.0 * aaStats.refined / pixels << "% of pixels refined, "
+                  << aaStats.samples / pixels << " spp on average (max " << aaMax << ")\n";
+    }
+    if (denoiseOn) {
+        auto t0 = Clock::now();
+        denoise(fb, threads);
+        std::cout << "Denoised in " << ms_since(t0) << " ms\n";
+    }
+    if (printStats || !statsJson.empty()) {
+        double renderMs = ms_since(renderStart);
+        RayCounts rc = collect_ray_counts();
+        if (workers > 0) std::cout << "(ray statistics cover this process only, not the workers)\n";
+        if (printStats) print_ray_stats(rc, renderMs);
+        if (!statsJson.empty() && !write_ray_stats_json(statsJson, rc, renderMs)) return 1;
+    }
+
+    // tone map and write PPM (and the linear buffer as PFM if asked)
+    ToneLUT lut;
+    lut.build(toneOp);
+    std::vector<unsigned char> img;
+    auto t0 = Clock::now();
+    tonemap(fb, lut, img, threads);
+    double toneMs = ms_since(t0);
+    if (!write_ppm("scene.ppm", width, height, img)) return 1;
+    std::cout << "Wrote scene.ppm (" << width << "x" << height << ", tone mapped in " << toneMs << " ms)\n";
+    if (!pfmFile.empty()) {
+        if (!write_pfm(pfmFile, fb)) return 1;
+        std::cout << "Wrote " << pfmFile << " (linear)\n";
+    }
     return 0;
 }